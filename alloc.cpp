@@ -0,0 +1,314 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "alloc.h"
+
+// Blocks handed out by the arena and by the tracked heap are preceded by a
+// header, rounded up so that the memory after it stays aligned
+static const size_t BLOCK_ALIGN = sizeof(double) > sizeof(void *) ? sizeof(double) : sizeof(void *);
+
+#if BARF_HEAP_TRACKING
+
+struct HeapHeader {
+	size_t size;
+	uint8_t tag;
+};
+
+static const size_t HEAP_HEADER = (sizeof(HeapHeader) + BLOCK_ALIGN - 1) / BLOCK_ALIGN * BLOCK_ALIGN;
+
+static HeapUsage total_usage;
+static HeapUsage tag_usage[HEAP_TAG_COUNT];
+static uint8_t current_tag = HEAP_TAG_OTHER;
+
+#define COUNT_ALLOCATION() (total_usage.allocations++, tag_usage[current_tag].allocations++)
+
+static void account(HeapUsage &usage, size_t added, size_t removed) {
+	usage.live += added;
+	usage.live -= removed;
+	if (usage.live > usage.peak) {
+		usage.peak = usage.live;
+	}
+}
+
+static void *heap_malloc(size_t size) {
+	uint8_t *block = (uint8_t *) malloc(HEAP_HEADER + size);
+	if (!block) {
+		return nullptr;
+	}
+
+	HeapHeader header = {size, current_tag};
+	memcpy(block, &header, sizeof(header));
+	account(total_usage, size, 0);
+	account(tag_usage[current_tag], size, 0);
+	return block + HEAP_HEADER;
+}
+
+static void *heap_realloc(void *ptr, size_t size) {
+	HeapHeader header;
+	memcpy(&header, (uint8_t *) ptr - HEAP_HEADER, sizeof(header));
+
+	uint8_t *block = (uint8_t *) realloc((uint8_t *) ptr - HEAP_HEADER, HEAP_HEADER + size);
+	if (!block) {
+		return nullptr;
+	}
+
+	// The block stays with the tag it was first allocated under
+	account(total_usage, size, header.size);
+	account(tag_usage[header.tag], size, header.size);
+	header.size = size;
+	memcpy(block, &header, sizeof(header));
+	return block + HEAP_HEADER;
+}
+
+static void heap_free(void *ptr) {
+	if (!ptr) {
+		return;
+	}
+
+	HeapHeader header;
+	memcpy(&header, (uint8_t *) ptr - HEAP_HEADER, sizeof(header));
+	account(total_usage, 0, header.size);
+	account(tag_usage[header.tag], 0, header.size);
+	free((uint8_t *) ptr - HEAP_HEADER);
+}
+
+HeapTag::HeapTag(uint8_t tag) : previous(current_tag) {
+	current_tag = tag;
+}
+
+HeapTag::~HeapTag() {
+	current_tag = previous;
+}
+
+HeapUsage barf_heap_usage() {
+	return total_usage;
+}
+
+HeapUsage barf_heap_usage(uint8_t tag) {
+	return tag_usage[tag];
+}
+
+unsigned long barf_allocation_count() {
+	return total_usage.allocations;
+}
+
+#else
+
+#define COUNT_ALLOCATION()
+
+static void *heap_malloc(size_t size) {
+	return malloc(size);
+}
+
+static void *heap_realloc(void *ptr, size_t size) {
+	return realloc(ptr, size);
+}
+
+static void heap_free(void *ptr) {
+	free(ptr);
+}
+
+HeapUsage barf_heap_usage() {
+	HeapUsage usage = {0, 0, 0};
+	return usage;
+}
+
+HeapUsage barf_heap_usage(uint8_t) {
+	return barf_heap_usage();
+}
+
+unsigned long barf_allocation_count() {
+	return 0;
+}
+
+#endif
+
+#ifdef __AVR__
+
+// avr-libc's free list and heap bounds, as laid out in its malloc.c
+struct __freelist {
+	size_t sz;
+	struct __freelist *nx;
+};
+extern struct __freelist *__flp;
+extern char *__brkval;
+extern char __heap_start;
+
+size_t barf_largest_free_block() {
+	// Either a block on the free list or the gap between the heap and the
+	// stack, less what malloc needs to keep track of the block
+	char *heap_end = __brkval ? __brkval : &__heap_start;
+	char stack;
+	size_t largest = &stack > heap_end ? &stack - heap_end : 0;
+
+	for (struct __freelist *block = __flp; block; block = block->nx) {
+		if (block->sz > largest) {
+			largest = block->sz;
+		}
+	}
+	return largest > sizeof(size_t) ? largest - sizeof(size_t) : 0;
+}
+
+#else
+
+size_t barf_largest_free_block() {
+	// Binary search for the largest size malloc still succeeds for
+	size_t low = 0;
+	size_t high = BARF_HEAP_PROBE_LIMIT;
+	while (low < high) {
+		size_t size = low + (high - low + 1) / 2;
+		void *block = malloc(size);
+		if (block) {
+			free(block);
+			low = size;
+		} else {
+			high = size - 1;
+		}
+	}
+	return low;
+}
+
+#endif
+
+#if BARF_ARENA_SIZE
+
+// Every arena allocation is preceded by its size
+static const size_t ARENA_ALIGN = BLOCK_ALIGN;
+static const size_t ARENA_HEADER = BLOCK_ALIGN;
+
+static union {
+	uint8_t bytes[BARF_ARENA_SIZE];
+	double align;
+} arena;
+
+static size_t arena_used = 0;
+static size_t arena_peak = 0;
+static size_t arena_overflows = 0;
+static uint8_t *arena_last = nullptr;
+static uint8_t arena_depth = 0;
+
+static bool in_arena(void *ptr) {
+	return (uint8_t *) ptr >= arena.bytes && (uint8_t *) ptr < arena.bytes + BARF_ARENA_SIZE;
+}
+
+static size_t arena_size_of(void *ptr) {
+	size_t size;
+	memcpy(&size, (uint8_t *) ptr - ARENA_HEADER, sizeof(size));
+	return size;
+}
+
+static void *arena_alloc(size_t size) {
+	size_t needed = ARENA_HEADER + (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+	if (needed > BARF_ARENA_SIZE - arena_used) {
+		arena_overflows++;
+		return nullptr;
+	}
+
+	uint8_t *ptr = arena.bytes + arena_used + ARENA_HEADER;
+	memcpy(ptr - ARENA_HEADER, &size, sizeof(size));
+	arena_used += needed;
+	arena_last = ptr;
+
+	if (arena_used > arena_peak) {
+		arena_peak = arena_used;
+	}
+	return ptr;
+}
+
+ArenaScope::ArenaScope() {
+	arena_depth++;
+}
+
+ArenaScope::~ArenaScope() {
+	arena_depth--;
+}
+
+void barf_arena_reset() {
+	arena_used = 0;
+	arena_last = nullptr;
+}
+
+size_t barf_arena_peak() {
+	return arena_peak;
+}
+
+size_t barf_arena_overflows() {
+	return arena_overflows;
+}
+
+void *barf_malloc(size_t size) {
+	COUNT_ALLOCATION();
+
+	if (arena_depth) {
+		void *ptr = arena_alloc(size);
+		if (ptr) {
+			return ptr;
+		}
+	}
+	return heap_malloc(size);
+}
+
+void *barf_realloc(void *ptr, size_t size) {
+	if (!ptr) {
+		return barf_malloc(size);
+	}
+	if (!in_arena(ptr)) {
+		COUNT_ALLOCATION();
+		return heap_realloc(ptr, size);
+	}
+
+	size_t old_size = arena_size_of(ptr);
+	if (ptr == arena_last) {
+		// The newest allocation can grow in place
+		size_t start = (uint8_t *) ptr - arena.bytes;
+		size_t end = start + (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+		if (end <= BARF_ARENA_SIZE) {
+			memcpy((uint8_t *) ptr - ARENA_HEADER, &size, sizeof(size));
+			arena_used = end;
+			if (arena_used > arena_peak) {
+				arena_peak = arena_used;
+			}
+			return ptr;
+		}
+	}
+
+	void *moved = barf_malloc(size);
+	if (moved) {
+		memcpy(moved, ptr, old_size < size ? old_size : size);
+	}
+	return moved;
+}
+
+void barf_free(void *ptr) {
+	// Arena memory is only ever given back all at once by a reset
+	if (!in_arena(ptr)) {
+		heap_free(ptr);
+	}
+}
+
+#else
+
+ArenaScope::ArenaScope() {}
+ArenaScope::~ArenaScope() {}
+void barf_arena_reset() {}
+size_t barf_arena_peak() { return 0; }
+size_t barf_arena_overflows() { return 0; }
+
+void *barf_malloc(size_t size) {
+	COUNT_ALLOCATION();
+	return heap_malloc(size);
+}
+
+void *barf_realloc(void *ptr, size_t size) {
+	COUNT_ALLOCATION();
+	if (!ptr) {
+		return heap_malloc(size);
+	}
+	return heap_realloc(ptr, size);
+}
+
+void barf_free(void *ptr) {
+	heap_free(ptr);
+}
+
+#endif
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+
+// All heap memory of the library goes through these. They back the global
+// operator new as well as the jsonic containers.
+void *barf_malloc(size_t size);
+void *barf_realloc(void *ptr, size_t size);
+void barf_free(void *ptr);
+
+#define JSONIC_MALLOC barf_malloc
+#define JSONIC_REALLOC barf_realloc
+#define JSONIC_FREE barf_free
+
+// Makes allocations come from the request arena while it exists. Without
+// an arena configured this does nothing.
+class ArenaScope {
+public:
+	ArenaScope();
+	~ArenaScope();
+};
+
+// Forgets everything allocated from the arena
+void barf_arena_reset();
+
+// Most bytes the arena had in use, and how many allocations didn't fit
+// and went to the heap instead
+size_t barf_arena_peak();
+size_t barf_arena_overflows();
+
+// Call sites heap usage is accounted to, see HeapTag
+enum {
+	HEAP_TAG_OTHER,
+	HEAP_TAG_REQUEST,
+	HEAP_TAG_GET_OR_POST,
+	HEAP_TAG_READ_LINE,
+	HEAP_TAG_COUNT
+};
+
+struct HeapUsage {
+	// Bytes currently allocated from the heap, and the most there ever were
+	size_t live;
+	size_t peak;
+	// Allocations made, the arena's included
+	unsigned long allocations;
+};
+
+// Accounts everything allocated while it exists to tag, which is restored
+// to the previous one afterwards. Does nothing without BARF_HEAP_TRACKING.
+class HeapTag {
+public:
+#if BARF_HEAP_TRACKING
+	explicit HeapTag(uint8_t tag);
+	~HeapTag();
+
+private:
+	uint8_t previous;
+#else
+	explicit HeapTag(uint8_t) {}
+#endif
+};
+
+// Usage of all tags together or of a single one, all zero unless
+// BARF_HEAP_TRACKING is set
+HeapUsage barf_heap_usage();
+HeapUsage barf_heap_usage(uint8_t tag);
+
+// Number of allocations so far, 0 unless BARF_HEAP_TRACKING is set
+unsigned long barf_allocation_count();
+
+// Size of the largest block malloc could hand out right now. On AVR this
+// walks the free list, elsewhere it is found by trying, up to
+// BARF_HEAP_PROBE_LIMIT bytes.
+size_t barf_largest_free_block();
@@ -2,11 +2,13 @@
 #include <Arduino.h>
 
 // new
-void * operator new (size_t size) { return malloc (size); }
-// placement new
+void * operator new (size_t size) { return barf_malloc (size); }
+#ifdef __AVR__
+// placement new, everywhere else it comes from <new>
 void * operator new (size_t size, void * ptr) { return ptr; }
+#endif
 // delete
-void operator delete (void * ptr) { free (ptr); }
+void operator delete (void * ptr) { barf_free (ptr); }
 
 #ifndef _getpid
 extern "C"{
@@ -15,33 +17,364 @@ extern "C"{
 }
 #endif
 
-Barf::Barf(Stream &serial, jString ssid, jString password, int baud_rate, bool allow_gpio) : ser(serial) {
-	this->ssid = ssid;
-	this->password = password;
+Barf::Barf(Stream &serial, const StrView &ssid, const StrView &password, unsigned long baud_rate, bool allow_gpio) : ser(serial) {
+	this->ssid = ssid.to_string();
+	this->password = password.to_string();
 	this->baud_rate = baud_rate;
+	this->initial_baud_rate = baud_rate;
+	this->baud_failures = 0;
+	this->baud_switch = nullptr;
+	this->baud_switch_context = nullptr;
 	this->allow_gpio = allow_gpio;
+	this->text_only = false;
+	this->binary_framing = false;
+	this->flow_control = false;
+	this->body_framing = false;
+	this->credit = 0;
+	this->parse_state = PARSE_IDLE;
+	this->rx_skip_line = false;
+	this->rx_async_line = -1;
+	this->rx_request_token = false;
+	this->last_rx = 0;
+	this->request_queue_head = 0;
+	this->request_queue_count = 0;
+	this->body_remaining = 0;
+	this->body_frame_remaining = 0;
+	this->body_slot = -1;
+	this->body_readable = false;
+	this->next_async_id = 0;
+
+	for (ResponseHandle handle = 0; handle < BARF_MAX_ASYNC_REQUESTS; ++handle) {
+		async_requests[handle].state = RESPONSE_NONE;
+	}
+
+#if BARF_STATS
+	memset(&statistics, 0, sizeof(statistics));
+	pending_parse_time = 0;
+#endif
+}
+
+void Barf::send_head(uint8_t opcode, uint32_t length) {
+	// Everything of a message that comes before its payload of length bytes
+	if (binary_framing) {
+		BARF_STAT(statistics.bytes_out += FRAME_HEADER_SIZE + length);
+		uint8_t header[FRAME_HEADER_SIZE];
+		frame_write_header(header, opcode, length);
+		ser.write(header, FRAME_HEADER_SIZE);
+		return;
+	}
+
+	const char *command = frame_command_name(opcode);
+	if (*command) {
+		ser.print(command);
+		if (length) {
+			ser.print(" ");
+		}
+		BARF_STAT(statistics.bytes_out += strlen(command) + (length != 0));
+	}
+	BARF_STAT(statistics.bytes_out += length + 1);
+}
+
+void Barf::send_message(uint8_t opcode, const StrView &value, const StrView &rest) {
+	// The payload is value, followed by a space and rest if there is any,
+	// written out piece by piece rather than joined first
+	uint32_t length = value.length() + (rest.empty() ? 0 : 1 + rest.length());
+	if (binary_framing && length > FRAME_MAX_PAYLOAD) {
+		send_split_message(opcode, value, rest, length);
+		return;
+	}
+
+	send_head(opcode, length);
+	ser.write((const uint8_t *) value.data(), value.length());
+	if (!rest.empty()) {
+		ser.print(" ");
+		ser.write((const uint8_t *) rest.data(), rest.length());
+	}
+	if (!binary_framing) {
+		ser.print("\n");
+	}
+}
+
+void Barf::send_split_message(uint8_t opcode, const StrView &value, const StrView &rest, uint32_t length) {
+	// A payload too long for one frame goes out in CONTINUATION frames
+	// after the first
+	StrView parts[3] = {value, rest.empty() ? StrView() : StrView(" ", 1), rest};
+	uint8_t part = 0;
+	uint32_t offset = 0;
+
+	while (length) {
+		uint16_t size = length < FRAME_MAX_PAYLOAD ? length : FRAME_MAX_PAYLOAD;
+		length -= size;
+
+		BARF_STAT(statistics.bytes_out += FRAME_HEADER_SIZE + size);
+		uint8_t header[FRAME_HEADER_SIZE];
+		frame_write_header(header, opcode, size, length != 0);
+		ser.write(header, FRAME_HEADER_SIZE);
+		opcode = FRAME_OP_CONTINUATION;
+
+		while (size) {
+			uint32_t piece = parts[part].length() - offset;
+			if (piece > size) {
+				piece = size;
+			}
+			ser.write((const uint8_t *) parts[part].data() + offset, piece);
+			offset += piece;
+			size -= piece;
+			if (offset == parts[part].length()) {
+				part++;
+				offset = 0;
+			}
+		}
+	}
 }
 
-void Barf::send_command(jString command, jString value) {
-	ser.print(command.c_str());
-	ser.print(" ");
-	ser.print(value.c_str());
-	ser.print("\n");
+void Barf::send_message_P(uint8_t opcode, const char *value) {
+	uint32_t length = 0;
+	while (pgm_read_byte(value + length)) {
+		length++;
+	}
+
+	send_head(opcode, length);
+	write_P(value, length);
+	if (!binary_framing) {
+		ser.print("\n");
+	}
 }
 
-void Barf::send_command(jString command) {
-	ser.print(command.c_str());
-	ser.print("\n");
+void Barf::write_P(const char *data, uint32_t length) {
+	// Flash can't be passed to the serial port directly, it goes out in
+	// small pieces copied to the stack
+	uint8_t piece[32];
+	while (length) {
+		uint8_t size = length < sizeof(piece) ? length : sizeof(piece);
+		memcpy_P(piece, data, size);
+		ser.write(piece, size);
+		data += size;
+		length -= size;
+	}
 }
 
-void Barf::send_data(jString data) {
-	ser.print(data.c_str());
-	ser.print("\n");
+void Barf::send_reply_chunk(const uint8_t *data, uint16_t length) {
+	if (binary_framing) {
+		send_message(FRAME_OP_REPLY_CHUNK, StrView((const char *) data, length));
+		return;
+	}
+
+	// Text lines can't hold arbitrary bytes, so the raw bytes follow the line
+	send_message(FRAME_OP_REPLY_CHUNK, NumberText(length));
+	BARF_STAT(statistics.bytes_out += length);
+	ser.write(data, length);
+}
+
+void Barf::send_reply_chunk_P(const char *data, uint16_t length) {
+	if (binary_framing) {
+		send_head(FRAME_OP_REPLY_CHUNK, length);
+	} else {
+		send_message(FRAME_OP_REPLY_CHUNK, NumberText(length));
+		BARF_STAT(statistics.bytes_out += length);
+	}
+	write_P(data, length);
+}
+
+void Barf::send_command(const StrView &command, const StrView &value) {
+	uint8_t opcode = frame_opcode(command.data(), command.length());
+
+	if (opcode == FRAME_OP_UNKNOWN) {
+		// Not a command we have an opcode for, pass it on as a plain line
+		send_message(FRAME_OP_LINE, command, value);
+	} else {
+		send_message(opcode, value);
+	}
+}
+
+void Barf::send_command(const StrView &command) {
+	send_command(command, StrView());
+}
+
+void Barf::send_command(const StrView &command, const __FlashStringHelper *value) {
+	uint8_t opcode = frame_opcode(command.data(), command.length());
+
+	if (opcode == FRAME_OP_UNKNOWN) {
+		// The line has to be sent in one go, so the value is copied out of
+		// flash first
+		jString line = command.to_string();
+		line.append(" ", 1);
+		for (const char *c = (const char *) value; pgm_read_byte(c); ++c) {
+			char byte = pgm_read_byte(c);
+			line.append(&byte, 1);
+		}
+		send_message(FRAME_OP_LINE, line);
+	} else {
+		send_message_P(opcode, (const char *) value);
+	}
+}
+
+void Barf::send_data(const StrView &data) {
+	send_message(binary_framing ? FRAME_OP_DATA : FRAME_OP_LINE, data);
+}
+
+void Barf::send_data(const __FlashStringHelper *data) {
+	send_message_P(binary_framing ? FRAME_OP_DATA : FRAME_OP_LINE, (const char *) data);
+}
+
+void Barf::negotiate_framing() {
+	// Offer frames with payloads that fit the receive buffer. Firmware
+	// without binary framing doesn't answer and we stay with text.
+	send_command(COMMAND_FRAMING, NumberText(BARF_RX_BUFFER_SIZE - FRAME_HEADER_SIZE));
+
+	binary_framing = read_line(COMMAND_FRAMING, BARF_FRAMING_TIMEOUT) == "1";
+}
+
+void Barf::negotiate_body_framing() {
+	// Firmware that doesn't know it still ends responses with response_end
+	send_command(COMMAND_BODY_FRAMING, "1");
+
+	body_framing = read_line(COMMAND_BODY_FRAMING, BARF_FRAMING_TIMEOUT) == "1";
+}
+
+void Barf::set_baud_switch(BaudSwitch baud_switch, void *context) {
+	this->baud_switch = baud_switch;
+	this->baud_switch_context = context;
+}
+
+void Barf::set_text_only(bool text_only) {
+	this->text_only = text_only;
+}
+
+bool Barf::check_baud_rate() {
+	// Stray bytes from the switch can show up as garbage lines before the
+	// echo, so only a timeout or a wrong echo count as failure
+	send_command(COMMAND_BAUD_CHECK, BAUD_CHECK_PATTERN);
+
+	unsigned long begin = millis();
+	while (true) {
+		unsigned long elapsed = millis() - begin;
+		if (elapsed > BARF_BAUD_CHECK_TIMEOUT) {
+			return false;
+		}
+
+		jString echo = read_line(COMMAND_BAUD_CHECK, BARF_BAUD_CHECK_TIMEOUT - elapsed);
+		if (echo == TIMEOUT) {
+			return false;
+		}
+		if (echo != UNEXPECTED_COMMAND) {
+			return echo == BAUD_CHECK_PATTERN;
+		}
+	}
+}
+
+bool Barf::try_baud_rate(unsigned long rate) {
+	send_command(COMMAND_BAUD_RATE, NumberText(rate));
+	if (read_line(COMMAND_BAUD_RATE, BARF_BAUD_CHECK_TIMEOUT) != "1") {
+		return false;
+	}
+
+	// The firmware switches as soon as its answer is out
+	unsigned long previous = baud_rate;
+	baud_switch(rate, baud_switch_context);
+	baud_rate = rate;
+	unsigned long switched = millis();
+	rx.clear();
+
+	if (check_baud_rate()) {
+		send_command(COMMAND_BAUD_CONFIRM);
+		return true;
+	}
+
+	// The firmware falls back by itself when the confirmation doesn't come,
+	// give it the time to. It switched before we did.
+	baud_switch(previous, baud_switch_context);
+	baud_rate = previous;
+	unsigned long waited = millis() - switched;
+	if (waited <= 2 * BARF_BAUD_CHECK_TIMEOUT) {
+		delay(2 * BARF_BAUD_CHECK_TIMEOUT - waited + 1);
+	}
+	rx.clear();
+	return false;
+}
+
+void Barf::negotiate_baud_rate() {
+	static const unsigned long ladder[] = { BARF_BAUD_LADDER };
+
+	for (uint8_t i = 0; i < sizeof(ladder) / sizeof(ladder[0]); ++i) {
+		if (ladder[i] <= baud_rate) {
+			return;
+		}
+		if (try_baud_rate(ladder[i])) {
+			return;
+		}
+		baud_failures++;
+	}
+}
+
+void Barf::negotiate_flow_control() {
+	uint16_t window = rx.free_space() < BARF_FLOW_WINDOW ? rx.free_space() : BARF_FLOW_WINDOW;
+	send_command(COMMAND_FLOW_CONTROL, NumberText(window));
+
+	if (read_line(COMMAND_FLOW_CONTROL, BARF_FRAMING_TIMEOUT) == "1") {
+		// Counting starts after the answer, whatever followed it is
+		// already in the buffer
+		flow_control = true;
+		credit = window > rx.size() ? window - rx.size() : 0;
+	}
+}
+
+void Barf::grant_credit() {
+	// Credit goes out in batches of at least half the window to keep the
+	// overhead down, or whenever the firmware has none left
+	uint16_t room = rx.free_space() < BARF_FLOW_WINDOW ? rx.free_space() : BARF_FLOW_WINDOW;
+	if (room <= credit) {
+		return;
+	}
+
+	uint16_t grant = room - credit;
+	if (grant < BARF_FLOW_WINDOW / 2 && credit > 0) {
+		return;
+	}
+
+	send_message(FRAME_OP_CREDIT, NumberText(grant));
+	credit += grant;
+}
+
+uint16_t Barf::receive() {
+	// Every read of the serial port goes through here so credit is kept
+	// in step with the bytes that actually arrived
+	if (flow_control) {
+		grant_credit();
+	}
+
+	uint16_t received = rx.fill(ser);
+	BARF_STAT(statistics.bytes_in += received);
+	if (received) {
+		// Also while a blocking call is waiting for its reply, so a request
+		// that arrives meanwhile isn't timed out afterwards
+		last_rx = millis();
+	}
+	if (flow_control) {
+		credit = received < credit ? credit - received : 0;
+	}
+	return received;
 }
 
 void Barf::init() {
-	// send_command(COMMAND_BAUD_RATE, baud_rate);
-	// ser.begin(baud_rate);
+	// Done before framing is negotiated, a failed switch can leave garbage
+	// that text lines recover from but frames don't
+	if (baud_switch) {
+		negotiate_baud_rate();
+	}
+
+	negotiate_body_framing();
+#if BARF_BINARY_FRAMING
+	if (!text_only) {
+		negotiate_framing();
+	}
+#endif
+#if BARF_FLOW_CONTROL
+	// The firmware would stall once nobody grants it credit
+	if (!text_only) {
+		negotiate_flow_control();
+	}
+#endif
 
 	send_command(COMMAND_SSID, ssid);
 	send_command(COMMAND_PASSWORD, password);
@@ -68,55 +401,224 @@ jString Barf::get_ip() {
 }
 
 void Barf::set_led_mode(int mode) {
-	char cmode[2];
-	itoa(mode, cmode, 10);
-	send_command(COMMAND_LED_MODE, jString(cmode));
+	send_command(COMMAND_LED_MODE, NumberText(mode));
+}
+
+static void append_text(jString &line, const char *text) {
+	line.append(text, strlen(text));
+}
+
+static void append_number(jString &line, unsigned long number) {
+	char text[NUMBER_TEXT_MAX];
+	line.append(text, format_number(text, sizeof(text), number));
 }
 
 jString Barf::debug_info() {
-	return jString(ser.readString().c_str());
+	// "baud_rate <rate> (<initial rate>, <failed rates> failed) framing
+	// <binary|text>", a line of statistics with BARF_STATS, then the
+	// firmware's own debug lines
+	jString info("baud_rate ");
+	append_number(info, baud_rate);
+	append_text(info, " (");
+	append_number(info, initial_baud_rate);
+	append_text(info, ", ");
+	append_number(info, baud_failures);
+	append_text(info, " failed) framing ");
+	append_text(info, binary_framing ? "binary" : "text");
+
+#if BARF_STATS
+	// "requests <parsed>/<dropped> parse_us <bucket>/<bucket>/... queue
+	// <depth>/<max> timeouts <read_line>/<responses> unexpected <n> bytes
+	// <in>/<out> rtt_ms <count>/<mean>/<max>"
+	append_text(info, "\nrequests ");
+	append_number(info, statistics.requests);
+	append_text(info, "/");
+	append_number(info, statistics.requests_dropped);
+	append_text(info, " parse_us ");
+	for (uint8_t bucket = 0; bucket < BARF_PARSE_TIME_BUCKETS; ++bucket) {
+		if (bucket) {
+			append_text(info, "/");
+		}
+		append_number(info, statistics.parse_time[bucket]);
+	}
+	append_text(info, " queue ");
+	append_number(info, statistics.queue_depth);
+	append_text(info, "/");
+	append_number(info, statistics.queue_depth_max);
+	append_text(info, " timeouts ");
+	append_number(info, statistics.read_timeouts);
+	append_text(info, "/");
+	append_number(info, statistics.response_timeouts);
+	append_text(info, " unexpected ");
+	append_number(info, statistics.unexpected_commands);
+	append_text(info, " bytes ");
+	append_number(info, statistics.bytes_in);
+	append_text(info, "/");
+	append_number(info, statistics.bytes_out);
+	append_text(info, " rtt_ms ");
+	append_number(info, statistics.round_trips);
+	append_text(info, "/");
+	append_number(info, statistics.round_trips ? statistics.round_trip_total / statistics.round_trips : 0);
+	append_text(info, "/");
+	append_number(info, statistics.round_trip_max);
+#endif
+
+	// The firmware ends its lines with an empty one. Older firmware sends
+	// a single line without it, those end when no more come.
+	send_command(COMMAND_DEBUG);
+	while (true) {
+		jString firmware = read_line(BARF_DEBUG_TIMEOUT);
+		if (firmware == TIMEOUT || firmware.length() == 0) {
+			break;
+		}
+		info.append("\n", 1);
+		info.append(firmware.c_str(), firmware.length());
+	}
+	return info;
 }
 
-jString Barf::read_line(jString expected_command, unsigned long timeout) {
+bool Barf::take_message(BarfMessage &message) {
+	if (body_remaining) {
+		// A request body nobody is reading is in the way
+		skip_body();
+		if (body_remaining) {
+			return false;
+		}
+	}
+
+	if (binary_framing) {
+		bool taken = rx.take_frame(message.opcode, message.value, message.complete);
+		if (rx.take_lost()) {
+			// Whatever was skipped may have been part of a request, which
+			// mustn't be run without it
+			reset_request();
+			rx_skip_line = false;
+		}
+		if (!taken) {
+			return false;
+		}
+
+		if (rx_skip_line && message.opcode != FRAME_OP_CONTINUATION) {
+			// The frames that were to carry on the last one never came
+			if (rx_request_token) {
+				reset_request();
+			}
+			rx_skip_line = false;
+		}
+
+		message.command = frame_command_name(message.opcode);
+		message.line = message.value;
+		message.framed = true;
+		return true;
+	}
+
+	if (!rx.take_line(message.line, message.complete)) {
+		return false;
+	}
+
+	split_command(message.line, message.command, message.value);
+	message.opcode = frame_opcode(message.command.data(), message.command.length());
+	message.framed = false;
+	return true;
+}
+
+bool Barf::wait_message(BarfMessage &message, unsigned long timeout) {
 	unsigned long begin = millis();
 
-	while(!ser.available()) {
+	while (!take_message(message)) {
 		if (millis() - begin > timeout) {
-			return TIMEOUT;
+			return false;
 		}
+		receive();
 	}
+	return true;
+}
 
-	jString line;
+// Whether a message belongs to an inbound request or an async response
+// rather than being the reply to a command
+static bool is_unsolicited(uint8_t opcode) {
+	return (opcode >= FRAME_OP_METHOD && opcode <= FRAME_OP_REQUEST_RESPONSE) ||
+		(opcode >= FRAME_OP_ASYNC_START && opcode <= FRAME_OP_ASYNC_DATA) ||
+		opcode == FRAME_OP_BODY_LENGTH;
+}
+
+static bool is_request_token(uint8_t opcode) {
+	return opcode == FRAME_OP_METHOD || opcode == FRAME_OP_PATH_FRAGMENT ||
+		opcode == FRAME_OP_GET_VAR || opcode == FRAME_OP_GET_VALUE;
+}
+
+jString Barf::read_line(const StrView &expected_command, unsigned long timeout) {
+	HeapTag tag(HEAP_TAG_READ_LINE);
+	unsigned long begin = millis();
+
+	// Lines that don't fit into the receive buffer arrive in pieces and
+	// are joined here, anything else is used straight from the buffer
+	BarfMessage message;
+	jString long_line;
+	bool is_long = false;
 
-	char c;
 	while (true) {
-		if (ser.available()) {
-			c = ser.read();
+		unsigned long elapsed = millis() - begin;
+		if (elapsed > timeout || !wait_message(message, timeout - elapsed)) {
+			BARF_STAT(statistics.read_timeouts++);
+			return TIMEOUT;
+		}
 
-			if (c == '\n') {
-				break;
-			}
+		if (!is_long && (rx_skip_line || is_unsolicited(message.opcode))) {
+			// Requests and async responses that arrive before the reply are
+			// dispatched rather than taken for it
+			dispatch(message);
+			continue;
+		}
 
-			line.push_back(c);
+		if (!is_long && message.opcode == FRAME_OP_CONTINUATION) {
+			// The rest of a frame whose beginning was lost
+			continue;
 		}
 
-		if (millis() - begin > timeout) {
-			return TIMEOUT;
+		if (is_long || !message.complete) {
+			if (!is_long && message.framed && !message.command.empty()) {
+				// Joined into the line the text protocol would have sent
+				long_line.append(message.command.data(), message.command.length());
+				long_line.append(" ", 1);
+			}
+			long_line.append(message.line.data(), message.line.length());
+			is_long = true;
+		}
+		if (message.complete) {
+			break;
 		}
 	}
-	if(!expected_command.length()) {
-		return line;
+
+	if (is_long) {
+		message.line = long_line;
+		split_command(message.line, message.command, message.value);
+		message.opcode = frame_opcode(message.command.data(), message.command.length());
 	}
 
-	if (line.substr(0, expected_command.length()) != expected_command) {
+	if (!expected_command.length()) {
+		if (message.framed && !message.command.empty()) {
+			// Give callers the line the text protocol would have sent
+			jString line = message.command.to_string();
+			line.append(" ", 1);
+			line.append(message.value.data(), message.value.length());
+			return line;
+		}
+		return message.line.to_string();
+	}
+
+	// Commands we know are told apart by opcode, anything else by its text
+	uint8_t expected_opcode = frame_opcode(expected_command.data(), expected_command.length());
+	if (expected_opcode != FRAME_OP_UNKNOWN ? message.opcode != expected_opcode : message.command != expected_command) {
+		BARF_STAT(statistics.unexpected_commands++);
 		return UNEXPECTED_COMMAND;
 	}
 
-	return line.substr(expected_command.length()+1);
+	return message.value.to_string();
 }
 
-jString Barf::read_line(jString expected_command) {
-	return read_line(expected_command, 10000);
+jString Barf::read_line(const StrView &expected_command) {
+	return read_line(expected_command, READ_TIMEOUT);
 }
 
 jString Barf::read_line(unsigned long timeout) {
@@ -124,91 +626,735 @@ jString Barf::read_line(unsigned long timeout) {
 }
 
 jString Barf::read_line() {
-	return read_line("", 10000);
+	return read_line("", READ_TIMEOUT);
 }
 
-jString Barf::get_or_post(jString command, jString url) {
+bool Barf::get_or_post(const StrView &command, const StrView &url, BodySink sink, void *context, ResponseInfo *info) {
+	HeapTag tag(HEAP_TAG_GET_OR_POST);
 	send_command(command, url);
+	BARF_STAT(unsigned long started = millis());
 
 	// We can't guarantee that the first line that comes back will be the response
-	// so we wait for RESPONSE_START and discard everything up to that point
+	// so we wait for RESPONSE_START. Requests and async responses that come
+	// first are dispatched, anything else up to that point is discarded.
+	// The head follows as lines or header frames, then the body as raw
+	// bytes or data frames up to where its length or encoding says it ends.
+	// Older firmware sends body lines or data frames up to response_end.
+	ResponseParser parser;
 	bool response_has_started = false;
+	bool skip_piece = false;
+	bool newline_pending = false;
+	bool ok = true;
 
-	jString response = "";
-	bool headers_finished = false;
-	while (true) {
-		jString line = read_line();
+	BarfMessage message;
+	while (!body_framing || !parser.finished()) {
+		if (response_has_started && parser.head_finished() && !binary_framing && body_framing) {
+			ok = read_text_body(parser, sink, context);
+			break;
+		}
 
-		if (line == COMMAND_RESPONSE_START) {
-			response_has_started = true;
-		} else if (line == TIMEOUT) {
-			return line;
-		} else if (!response_has_started) {
+		if (!wait_message(message, READ_TIMEOUT)) {
+			ok = false;
+			break;
+		}
+
+		// Head lines can look like anything, only async responses are told
+		// apart from them
+		bool is_async = message.opcode >= FRAME_OP_ASYNC_START && message.opcode <= FRAME_OP_ASYNC_DATA;
+		bool in_text_head = response_has_started && !message.framed;
+		if (rx_skip_line || is_async || (!in_text_head && is_unsolicited(message.opcode))) {
+			dispatch(message);
 			continue;
-		} else if (line == COMMAND_RESPONSE_END) {
+		}
+
+		if (!message.framed) {
+			if (!response_has_started) {
+				response_has_started = message.opcode == FRAME_OP_RESPONSE_START && message.value.empty();
+			} else if (parser.head_finished()) {
+				// Body lines of older firmware, their newlines are passed
+				// on once the next line shows the body goes on
+				if (!skip_piece && message.opcode == FRAME_OP_RESPONSE_END && message.value.empty()) {
+					break;
+				}
+				if (newline_pending) {
+					sink("\n", 1, context);
+				}
+				sink(message.line.data(), message.line.length(), context);
+				skip_piece = !message.complete;
+				newline_pending = message.complete;
+			} else if (skip_piece || !message.complete) {
+				// Head lines too long for the receive buffer don't carry
+				// anything we look at
+				skip_piece = !message.complete;
+			} else {
+				parser.head_line(message.line);
+			}
+			continue;
+		}
+
+		if (!response_has_started) {
+			response_has_started = message.opcode == FRAME_OP_RESPONSE_START;
+			continue;
+		}
+
+		switch (message.opcode) {
+			case FRAME_OP_RESPONSE_HEADER:
+				// Header lines split over several frames don't carry
+				// anything we look at
+				if (message.complete) {
+					parser.head_line(message.value);
+				}
+				break;
+			case FRAME_OP_RESPONSE_DATA:
+				parser.head_line(StrView());
+				if (body_framing) {
+					parser.feed(message.value.data(), message.value.length(), sink, context);
+				} else {
+					sink(message.value.data(), message.value.length(), context);
+				}
+				break;
+			default:
+				break;
+		}
+		if (message.opcode == FRAME_OP_RESPONSE_END && !body_framing) {
 			break;
-		} else {
-			if (headers_finished) {
-				response = response + line;
+		}
+	}
+
+	if (info) {
+		*info = parser.info();
+	}
+#if BARF_STATS
+	if (ok) {
+		record_round_trip(millis() - started);
+	} else {
+		statistics.response_timeouts++;
+	}
+#endif
+	return ok;
+}
+
+bool Barf::read_text_body(ResponseParser &parser, BodySink sink, void *context) {
+	// Text lines can't hold arbitrary bytes, so the body follows the head
+	// raw and is taken straight out of the receive buffer
+	unsigned long last_data = millis();
+
+	while (!parser.finished()) {
+		StrView bytes = rx.peek_bytes();
+		if (bytes.empty()) {
+			if (millis() - last_data > READ_TIMEOUT) {
+				return false;
 			}
-			if(!line.length()) {
-				headers_finished = true;
+			receive();
+			continue;
+		}
+
+		rx.drop(parser.feed(bytes.data(), bytes.length(), sink, context));
+		last_data = millis();
+	}
+	return true;
+}
+
+uint32_t Barf::take_body(char *buffer, uint32_t size) {
+	// Takes up to size bytes of the body that have arrived, dropping them
+	// if buffer is null
+	uint32_t taken = 0;
+
+	while (body_remaining && taken < size) {
+		if (binary_framing && !body_frame_remaining) {
+			uint8_t opcode;
+			uint16_t length;
+			if (!rx.peek_frame_header(opcode, length)) {
+				break;
 			}
+			if (opcode != FRAME_OP_BODY) {
+				// The body was cut short
+				body_remaining = 0;
+				break;
+			}
+			rx.drop(FRAME_HEADER_SIZE);
+			body_frame_remaining = length;
+			continue;
+		}
+
+		StrView bytes = rx.peek_bytes();
+		uint32_t length = bytes.length();
+		if (!length) {
+			break;
+		}
+		if (length > body_remaining) {
+			length = body_remaining;
+		}
+		if (binary_framing && length > body_frame_remaining) {
+			length = body_frame_remaining;
+		}
+		if (length > size - taken) {
+			length = size - taken;
+		}
+
+		if (buffer) {
+			memcpy(buffer + taken, bytes.data(), length);
+		}
+		rx.drop(length);
+		taken += length;
+		body_remaining -= length;
+		if (binary_framing) {
+			body_frame_remaining -= length;
+		}
+	}
+	return taken;
+}
+
+void Barf::skip_body() {
+	if (body_slot >= 0) {
+		// The request is still queued, so its body is gone by the time
+		// it is returned
+		request_queue[body_slot].body.body_dropped = true;
+		body_slot = -1;
+	}
+	body_readable = false;
+
+	while (body_remaining && take_body(nullptr, body_remaining)) {
+		receive();
+	}
+}
+
+uint32_t Barf::read_body(char *buffer, uint32_t size) {
+	unsigned long begin = millis();
+
+	while (body_readable && body_remaining) {
+		uint32_t taken = take_body(buffer, size);
+		if (taken) {
+			return taken;
+		}
+		if (millis() - begin > READ_TIMEOUT) {
+			break;
 		}
+		receive();
 	}
+	return 0;
+}
+
+uint32_t RequestBody::remaining() const {
+	return barf && barf->body_readable ? barf->body_remaining : 0;
+}
 
+uint32_t RequestBody::read(char *buffer, uint32_t size) {
+	return barf ? barf->read_body(buffer, size) : 0;
+}
+
+int RequestBody::read() {
+	char c;
+	return read(&c, 1) ? (uint8_t) c : -1;
+}
+
+bool Barf::get(const StrView &url, BodySink sink, void *context, ResponseInfo *info) {
+	return get_or_post(COMMAND_GET, url, sink, context, info);
+}
+
+bool Barf::post(const StrView &url, BodySink sink, void *context, ResponseInfo *info) {
+	return get_or_post(COMMAND_POST, url, sink, context, info);
+}
+
+struct BufferSink {
+	char *buffer;
+	uint32_t size;
+	// Length of the whole body, of which what fits is stored
+	uint32_t length;
+};
+
+static void append_to_buffer(const char *data, uint32_t length, void *context) {
+	BufferSink *sink = (BufferSink *) context;
+
+	if (sink->length < sink->size - 1) {
+		uint32_t room = sink->size - 1 - sink->length;
+		memcpy(sink->buffer + sink->length, data, length < room ? length : room);
+	}
+	sink->length += length;
+}
+
+struct StringSink {
+	jString *response;
+	bool truncated;
+};
+
+static void append_to_string(const char *data, uint32_t length, void *context) {
+	StringSink *sink = (StringSink *) context;
+
+	uint32_t room = BARF_MAX_RESPONSE_SIZE - sink->response->length();
+	if (length > room) {
+		length = room;
+		sink->truncated = true;
+	}
+	sink->response->append(data, length);
+}
+
+jString Barf::get_or_post(const StrView &command, const StrView &url, ResponseInfo *info) {
+	jString response;
+	StringSink sink = {&response, false};
+	if (!get_or_post(command, url, append_to_string, &sink, info)) {
+		return TIMEOUT;
+	}
+	if (info) {
+		info->truncated = sink.truncated;
+	}
 	return response;
 }
 
-jString Barf::get(jString url) {
-	return get_or_post(COMMAND_GET, url);
+jString Barf::get(const StrView &url, ResponseInfo *info) {
+	return get_or_post(COMMAND_GET, url, info);
+}
+
+jString Barf::post(const StrView &url, ResponseInfo *info) {
+	return get_or_post(COMMAND_POST, url, info);
 }
 
-jString Barf::post(jString url) {
-	return get_or_post(COMMAND_POST, url);
+int32_t Barf::get_or_post(const StrView &command, const StrView &url, char *buffer, uint32_t size, ResponseInfo *info) {
+	if (!size) {
+		return -1;
+	}
+
+	BufferSink sink = {buffer, size, 0};
+	bool ok = get_or_post(command, url, append_to_buffer, &sink, info);
+	bool truncated = sink.length > size - 1;
+	buffer[truncated ? size - 1 : sink.length] = '\0';
+	if (info) {
+		info->truncated = truncated;
+	}
+	return ok ? sink.length : -1;
+}
+
+int32_t Barf::get(const StrView &url, char *buffer, uint32_t size, ResponseInfo *info) {
+	return get_or_post(COMMAND_GET, url, buffer, size, info);
+}
+
+int32_t Barf::post(const StrView &url, char *buffer, uint32_t size, ResponseInfo *info) {
+	return get_or_post(COMMAND_POST, url, buffer, size, info);
+}
+
+ResponseHandle Barf::start_async(uint8_t opcode, const StrView &url, BodySink sink, void *context, ResponseCallback done) {
+	ResponseHandle handle = 0;
+	while (async_requests[handle].state != RESPONSE_NONE) {
+		if (++handle == BARF_MAX_ASYNC_REQUESTS) {
+			return -1;
+		}
+	}
+
+	// Ids only need to tell apart the requests in flight, so they just
+	// count up and wrap around
+	AsyncRequest &request = async_requests[handle];
+	request.state = RESPONSE_PENDING;
+	request.id = next_async_id++;
+	request.headers_finished = false;
+	request.line_pending = false;
+	request.sink = sink;
+	request.context = context;
+	request.done = done;
+	request.started = millis();
+
+	send_message(opcode, NumberText(request.id), url);
+
+	return handle;
+}
+
+ResponseHandle Barf::get_async(const StrView &url, BodySink sink, void *context, ResponseCallback done) {
+	return start_async(FRAME_OP_ASYNC_GET, url, sink, context, done);
+}
+
+ResponseHandle Barf::post_async(const StrView &url, BodySink sink, void *context, ResponseCallback done) {
+	return start_async(FRAME_OP_ASYNC_POST, url, sink, context, done);
+}
+
+ResponseState Barf::response_state(ResponseHandle handle) {
+	if (handle < 0 || handle >= BARF_MAX_ASYNC_REQUESTS) {
+		return RESPONSE_NONE;
+	}
+
+	pump(false);
+
+	AsyncRequest &request = async_requests[handle];
+	ResponseState state = request.state;
+	if (state == RESPONSE_DONE || state == RESPONSE_TIMEOUT) {
+		request.state = RESPONSE_NONE;
+	}
+	return state;
+}
+
+// Splits the "<id> <rest>" value every async response message has
+static bool split_async_id(const StrView &value, uint8_t &id, StrView &rest) {
+	int space = value.find(' ');
+	uint32_t digits = space < 0 ? value.length() : space;
+	unsigned long number;
+	if (!digits || parse_number(value.substr(0, digits), number) != digits || number > 0xff) {
+		return false;
+	}
+
+	id = number;
+	rest = space < 0 ? StrView() : value.substr(space + 1);
+	return true;
+}
+
+ResponseHandle Barf::handle_async_message(const BarfMessage &message) {
+	// Returns the request the message belongs to, -1 for messages of
+	// requests that already timed out
+	uint8_t id;
+	StrView rest;
+	if (!split_async_id(message.value, id, rest)) {
+		return -1;
+	}
+
+	ResponseHandle handle = 0;
+	while (async_requests[handle].state != RESPONSE_PENDING || async_requests[handle].id != id) {
+		if (++handle == BARF_MAX_ASYNC_REQUESTS) {
+			return -1;
+		}
+	}
+
+	AsyncRequest &request = async_requests[handle];
+	switch (message.opcode) {
+		case FRAME_OP_ASYNC_LINE:
+			// Text responses are header lines up to an empty line, then the
+			// body line by line. The newline of a body line is passed on
+			// once the next one arrives, the last one doesn't have any.
+			if (request.headers_finished) {
+				if (request.line_pending) {
+					async_data(handle, "\n");
+				}
+				async_data(handle, rest);
+				request.line_pending = message.complete;
+			} else if (rest.empty()) {
+				request.headers_finished = true;
+			}
+			break;
+		case FRAME_OP_ASYNC_DATA:
+			async_data(handle, rest);
+			break;
+		case FRAME_OP_ASYNC_END:
+			finish_async(handle, RESPONSE_DONE);
+			break;
+		default:
+			break;
+	}
+	return handle;
+}
+
+void Barf::async_data(ResponseHandle handle, const StrView &data) {
+	AsyncRequest &request = async_requests[handle];
+	if (request.state == RESPONSE_PENDING && !data.empty()) {
+		request.sink(data.data(), data.length(), request.context);
+	}
+}
+
+void Barf::finish_async(ResponseHandle handle, ResponseState state) {
+	AsyncRequest &request = async_requests[handle];
+#if BARF_STATS
+	if (state == RESPONSE_DONE) {
+		record_round_trip(millis() - request.started);
+	} else {
+		statistics.response_timeouts++;
+	}
+#endif
+	if (!request.done) {
+		// Kept until response_state() reports it
+		request.state = state;
+		return;
+	}
+
+	// Released first so the callback can start another request
+	request.state = RESPONSE_NONE;
+	request.done(handle, state, request.context);
 }
 
 void Barf::get_command_value(jString &command, jString &value) {
 	jString line = read_line();
-	int space_index = line.find(" ");
+	StrView command_view;
+	StrView value_view;
+	split_command(line, command_view, value_view);
 
-	if (space_index != -1) {
-		command = line.substr(0, space_index);
-		value = line.substr(space_index + 1);
-	} else {
-		command = line;
-		value = "";
+	command = command_view.to_string();
+	value = value_view.to_string();
+}
+
+void Barf::reset_request() {
+	pending_request.clear();
+	parse_state = PARSE_IDLE;
+	BARF_STAT(pending_parse_time = 0);
+}
+
+#if BARF_STATS
+void Barf::record_request() {
+	statistics.requests++;
+
+	uint8_t bucket = 0;
+	while (bucket < BARF_PARSE_TIME_BUCKETS - 1 && pending_parse_time >= (32UL << bucket)) {
+		bucket++;
+	}
+	statistics.parse_time[bucket]++;
+
+	statistics.queue_depth = request_queue_count;
+	if (request_queue_count > statistics.queue_depth_max) {
+		statistics.queue_depth_max = request_queue_count;
 	}
 }
 
-Request Barf::run() {
-	// Handle requests incoming over wifi
-	Request request;
-	jString command;
-	jString value;
-
-	if (ser.available()) {
-		get_command_value(command, value);
-
-		if (command == COMMAND_METHOD) {
-			// Begins a new request
-			request.method = value;
-
-			while (command != COMMAND_REQUEST_RESPONSE) {
-				get_command_value(command, value);
-
-				if (command == COMMAND_PATH_FRAGMENT) {
-					request.fragments.push_back(value);
-				} else if (command == COMMAND_GET_VAR) {
-					RequestVar var({value, read_line(COMMAND_GET_VALUE)});
-					request.get_vars.push_back(var);
-				} else if (command == TIMEOUT) {
-					// Give up waiting for the respond command if reading the line times out
-					break;
+void Barf::record_round_trip(unsigned long ms) {
+	statistics.round_trips++;
+	statistics.round_trip_total += ms;
+	if (ms > statistics.round_trip_max) {
+		statistics.round_trip_max = ms;
+	}
+}
+#endif
+
+static uint32_t parse_length(const StrView &value) {
+	unsigned long length;
+	return parse_number(value, length) && length <= 0xffffffffUL ? length : 0;
+}
+
+bool Barf::parse_request_message(const BarfMessage &message) {
+	// Feeds one complete message into the request parser, returns true once
+	// the respond command completes the pending request
+	if (message.opcode == FRAME_OP_METHOD) {
+		// Begins a new request, dropping any half-received one
+		reset_request();
+		pending_request.set_method(message.value);
+		parse_state = PARSE_REQUEST;
+		return false;
+	}
+
+	switch (parse_state) {
+		case PARSE_IDLE:
+			// Not part of a request
+			return false;
+		case PARSE_GET_VALUE:
+		case PARSE_SKIP_VALUE:
+			if (message.opcode == FRAME_OP_GET_VALUE) {
+				if (parse_state == PARSE_GET_VALUE) {
+					pending_request.set_var_value(message.value);
 				}
+				parse_state = PARSE_REQUEST;
+				return false;
+			}
+			// A var without a value, the message is the next part of the
+			// request
+			parse_state = PARSE_REQUEST;
+			return parse_request_message(message);
+		case PARSE_REQUEST:
+			switch (message.opcode) {
+				case FRAME_OP_PATH_FRAGMENT:
+					pending_request.add_fragment(message.value);
+					break;
+				case FRAME_OP_GET_VAR:
+					parse_state = pending_request.add_var(message.value) ? PARSE_GET_VALUE : PARSE_SKIP_VALUE;
+					break;
+				case FRAME_OP_BODY_LENGTH:
+					pending_request.body.body_length = parse_length(message.value);
+					break;
+				case FRAME_OP_REQUEST_RESPONSE:
+					return true;
+				default:
+					break;
+			}
+			return false;
+	}
+	return false;
+}
+
+bool Barf::on(const char *method, const char *pattern, RouteHandler handler) {
+	return router.add(method, pattern, handler);
+}
+
+void Barf::dispatch(const BarfMessage &message) {
+	if (rx_skip_line) {
+		// The rest of an over-long line
+		if (rx_async_line >= 0) {
+			async_data(rx_async_line, message.line);
+			async_requests[rx_async_line].line_pending = message.complete;
+		} else if (rx_request_token) {
+			HeapTag tag(HEAP_TAG_REQUEST);
+			pending_request.append(message.line);
+		}
+		rx_skip_line = !message.complete;
+		return;
+	}
+
+	if (message.opcode >= FRAME_OP_ASYNC_START && message.opcode <= FRAME_OP_ASYNC_DATA) {
+		ResponseHandle handle = handle_async_message(message);
+		if (!message.complete) {
+			// Body lines of text responses can be longer than the buffer
+			rx_skip_line = true;
+			rx_async_line = message.opcode == FRAME_OP_ASYNC_LINE && handle >= 0 && async_requests[handle].headers_finished ? handle : -1;
+			rx_request_token = false;
+		}
+		return;
+	}
+
+	if (!message.complete) {
+		// Long path fragments and vars arrive in pieces, the first one is
+		// parsed as usual and the rest appended to it. Other lines this
+		// long can't be commands we know.
+		rx_skip_line = true;
+		rx_async_line = -1;
+		rx_request_token = is_request_token(message.opcode);
+		if (!rx_request_token) {
+			return;
+		}
+		// A piece the parser doesn't store mustn't extend an earlier token
+		pending_request.close_token();
+	}
+
+	BARF_STAT(unsigned long parse_start = micros());
+	bool complete;
+	{
+		HeapTag tag(HEAP_TAG_REQUEST);
+		complete = parse_request_message(message);
+	}
+	BARF_STAT(pending_parse_time += micros() - parse_start);
+
+	if (complete) {
+		// The body comes right after the request, run() stops in front of it
+		// so it can be read once the request is returned
+		body_remaining = pending_request.body.body_length;
+		body_frame_remaining = 0;
+		body_slot = -1;
+
+		if (request_queue_count < BARF_REQUEST_QUEUE_SIZE) {
+			uint8_t tail = (request_queue_head + request_queue_count) % BARF_REQUEST_QUEUE_SIZE;
+			request_queue[tail].take(pending_request);
+			request_queue_count++;
+			if (body_remaining) {
+				body_slot = tail;
 			}
+			BARF_STAT(record_request());
+		} else {
+			BARF_STAT(statistics.requests_dropped++);
 		}
+		reset_request();
+	}
+}
+
+bool Barf::request_waiting() const {
+	// Whether the next message in the receive buffer begins a request
+	if (binary_framing) {
+		uint8_t opcode;
+		uint16_t length;
+		return rx.peek_frame_header(opcode, length) && opcode == FRAME_OP_METHOD;
+	}
+	return rx.starts_with(StrView(COMMAND_METHOD " "));
+}
+
+void Barf::pump(bool keep_body) {
+	// Handles whatever input is available without blocking. With the request
+	// queue full the next request stays in the receive buffer until run() has
+	// returned one, async responses and replies before it are still handled.
+	// So does the body of a queued request if keep_body is set, otherwise it
+	// is skipped.
+	while (true) {
+		if (keep_body && body_remaining && body_slot >= 0) {
+			break;
+		}
+		if (request_queue_count == BARF_REQUEST_QUEUE_SIZE && request_waiting()) {
+			break;
+		}
+
+		BarfMessage message;
+		if (!take_message(message)) {
+			if (!receive()) {
+				break;
+			}
+			continue;
+		}
+		dispatch(message);
+	}
+
+	unsigned long now = millis();
+	for (ResponseHandle handle = 0; handle < BARF_MAX_ASYNC_REQUESTS; ++handle) {
+		if (async_requests[handle].state == RESPONSE_PENDING && now - async_requests[handle].started > READ_TIMEOUT) {
+			finish_async(handle, RESPONSE_TIMEOUT);
+		}
+	}
+
+	if (parse_state != PARSE_IDLE && now - last_rx > READ_TIMEOUT) {
+		// Give up on a request if the respond command doesn't arrive in time
+		reset_request();
+	}
+}
+
+CompactRequest *Barf::next_request() {
+	// Handle requests incoming over wifi and responses to async requests.
+	// Only the bytes that are already available are consumed, so this never
+	// blocks; partial lines and partial requests are kept until the next call.
+	// Whatever the previous request left of its body is skipped.
+	body_readable = false;
+	pump(true);
+
+	if (!request_queue_count) {
+		return nullptr;
+	}
+
+	CompactRequest &request = request_queue[request_queue_head];
+	if (body_slot == request_queue_head) {
+		body_slot = -1;
+		body_readable = true;
+		request.body.barf = this;
+	}
+	return &request;
+}
+
+void Barf::release_request() {
+	// Done with the request next_request() returned, its slot keeps the
+	// buffer for the next one
+	request_queue[request_queue_head].clear();
+	request_queue_head = (request_queue_head + 1) % BARF_REQUEST_QUEUE_SIZE;
+	request_queue_count--;
+	BARF_STAT(statistics.queue_depth = request_queue_count);
+}
+
+Request Barf::run() {
+	CompactRequest *queued = next_request();
+	if (!queued) {
+		return Request();
+	}
+
+	// Routes are matched on the queued request, so it is built only once:
+	// in the arena for a handler, on the heap for the sketch to keep
+	RouteParams params;
+	RouteHandler handler = router.match(*queued, params);
+	if (!handler) {
+		Request request;
+		{
+			HeapTag tag(HEAP_TAG_REQUEST);
+			request = queued->to_request();
+		}
+		release_request();
+		return request;
+	}
+
+	{
+		// A request for a route only lives while its handler runs, so the
+		// arena is free again once it is gone
+		Request request;
+		{
+			ArenaScope arena;
+			HeapTag tag(HEAP_TAG_REQUEST);
+			request = queued->to_request();
+		}
+		release_request();
+		params.bind(request);
+		handler(*this, request, params);
+	}
+	barf_arena_reset();
+	return Request();
+}
+
+bool Barf::run(CompactRequest &request) {
+	CompactRequest *queued = next_request();
+	if (!queued) {
+		request.clear();
+		return false;
 	}
 
-	return request;
+	request.take(*queued);
+	release_request();
+	return true;
 }
@@ -1,38 +1,242 @@
 #pragma once
-#ifndef nullptr
+#if __cplusplus < 201103L && !defined(nullptr)
 #define nullptr NULL
 #endif
 
 #include <Stream.h>
+#include "alloc.h"
 #include "jsonic/containers.h"
 #include "constants.h"
+#include "config.h"
+#include "str_view.h"
+#include "number.h"
+#include "rx_buffer.h"
+#include "router.h"
+#include "response_writer.h"
+#include "response_parser.h"
+#include "stats.h"
 
 void * operator new (size_t size);
-// placement new
+#ifdef __AVR__
+// placement new, everywhere else it comes from <new>
 void * operator new (size_t size, void * ptr);
+#endif
 // delete
 void operator delete (void * ptr);
 
 typedef jsonic::containers::String jString;
 
+#define READ_TIMEOUT 10000
+
 struct RequestVar {
 	jString name;
 	jString value;
 };
 
+// One unit of input: a text line split into command and value, or a
+// binary frame. The views point into the receive buffer.
+struct BarfMessage {
+	uint8_t opcode;
+	StrView command;
+	StrView value;
+	// The whole text line, or the payload of a frame
+	StrView line;
+	bool framed;
+	// False for a piece of a text line that didn't fit the receive buffer
+	bool complete;
+};
+
+// Switches the sketch's end of the serial link to a new baud rate, usually
+// by calling begin() on the serial port
+typedef void (*BaudSwitch)(unsigned long baud_rate, void *context);
+
+// Handle of a request started with get_async() or post_async()
+typedef int8_t ResponseHandle;
+
+enum ResponseState {
+	// Not a handle of a request in flight
+	RESPONSE_NONE,
+	RESPONSE_PENDING,
+	RESPONSE_DONE,
+	RESPONSE_TIMEOUT
+};
+
+// Called when an asynchronous request completes or times out
+typedef void (*ResponseCallback)(ResponseHandle handle, ResponseState state, void *context);
+
+class Barf;
+
+// Reads the body of a request returned by run() straight from the serial
+// link, so it never has to fit in memory. It has to be read before
+// anything else is received, whatever is left unread is skipped by the
+// next call to run() or anything that waits for an answer.
+class RequestBody {
+public:
+	RequestBody() : barf(nullptr), body_length(0), body_dropped(false) {}
+
+	// Length the body was announced with
+	uint32_t length() const { return body_length; }
+	// Bytes that can still be read
+	uint32_t remaining() const;
+	// Set if the body was skipped because the request had to wait in the
+	// queue while other input was received
+	bool dropped() const { return body_dropped; }
+
+	// Reads up to size bytes into buffer, waiting up to READ_TIMEOUT for
+	// the first of them. Returns how many were read, 0 at the end of the
+	// body or on timeout.
+	uint32_t read(char *buffer, uint32_t size);
+	// Next byte of the body, -1 at its end or on timeout
+	int read();
+
+private:
+	friend class Barf;
+
+	Barf *barf;
+	uint32_t body_length;
+	bool body_dropped;
+};
+
 struct Request {
 	jString method;
 	jsonic::containers::Vector<jString> fragments;
 	jsonic::containers::Vector<RequestVar> get_vars;
+	// Position in get_vars of the last var with each name hash. The names
+	// themselves are only kept in get_vars.
+	jsonic::containers::HashMap<uint32_t, uint32_t> get_var_index;
+	RequestBody body;
 
 	bool is_null() {
 		return method.length() == 0;
 	}
+
+	void add_var(jString name, jString value) {
+		get_var_index.insert(var_hash(name), get_vars.size());
+		get_vars.push_back(RequestVar({jsonic::containers::move(name), jsonic::containers::move(value)}));
+	}
+
+	// Value of the query string argument name, nullptr if the request
+	// doesn't have it. If it occurs more than once this is the last one.
+	const jString *get_var(const jString &name) const {
+		const uint32_t *index = get_var_index.find_value(var_hash(name));
+		if (!index) {
+			return nullptr;
+		}
+		// A later var whose name has the same hash hides this one, which
+		// is then searched for
+		for (uint32_t i = *index + 1; i > 0; --i) {
+			if (get_vars[i - 1].name == name) {
+				return &get_vars[i - 1].value;
+			}
+		}
+		return nullptr;
+	}
+
+	static uint32_t var_hash(const jString &name) {
+		return jsonic::containers::KeyHash<jString>()(name);
+	}
+};
+
+// The same request in a single buffer: the text of every token back to back
+// from the start, and an (offset, length) entry per token from the end. The
+// method comes first, then the path fragments, then a name and a value per
+// query string argument. Accessors return views into the buffer, which stay
+// valid until the request is cleared or filled again.
+class CompactRequest {
+public:
+	// Allocates a buffer on first use and grows it as needed. Filling the
+	// same object again reuses the buffer.
+	CompactRequest();
+	// Uses the size bytes of buffer and never allocates. Tokens that don't
+	// fit are left out and set truncated().
+	CompactRequest(char *buffer, uint16_t size);
+	~CompactRequest();
+
+	bool is_null() const { return token_count == 0; }
+	// Set if a token was left out for lack of space
+	bool truncated() const { return overflow; }
+
+	StrView method() const;
+	uint8_t fragment_count() const { return num_fragments; }
+	StrView fragment(uint8_t index) const;
+	uint8_t var_count() const { return num_vars; }
+	StrView var_name(uint8_t index) const;
+	StrView var_value(uint8_t index) const;
+	// Sets value to the query string argument name and returns true if the
+	// request has it. If it occurs more than once this is the last one.
+	bool get_var(const StrView &name, StrView &value) const;
+
+	// Copies the request into the separately allocated layout
+	Request to_request() const;
+
+	RequestBody body;
+
+	void clear();
+	void set_method(const StrView &method);
+	// Fragments have to come before the first var, later ones are left out
+	void add_fragment(const StrView &fragment);
+	// Adds a var with an empty value, which set_var_value() fills in.
+	// Returns false if it doesn't fit, its value must then be left out.
+	bool add_var(const StrView &name);
+	// Sets the value of the var added last
+	void set_var_value(const StrView &value);
+	// Adds text to the end of the token stored last, for tokens that
+	// arrive in pieces. Does nothing if that token was left out.
+	void append(const StrView &text);
+	void close_token() { open_token = NO_TOKEN; }
+
+	// Makes this a copy of other, within the limits of this one's buffer
+	void assign(const CompactRequest &other);
+	// Moves other into this and clears it. Requests that both own their
+	// buffers just exchange them.
+	void take(CompactRequest &other);
+
+private:
+	struct Token {
+		uint16_t offset;
+		uint16_t length;
+	};
+
+	static const uint8_t NO_TOKEN = 0xff;
+
+	CompactRequest(const CompactRequest &);
+	CompactRequest &operator=(const CompactRequest &);
+
+	void swap(CompactRequest &other);
+
+	Token token(uint8_t index) const;
+	StrView token_view(uint8_t index) const;
+	bool reserve(uint32_t length, uint8_t tokens);
+	bool push_token(const StrView &text);
+	void set_token(uint8_t index, const StrView &text);
+
+	char *buffer;
+	uint16_t capacity;
+	// Bytes of token text at the start of buffer
+	uint16_t used;
+	uint8_t token_count;
+	uint8_t num_fragments;
+	uint8_t num_vars;
+	// Token that append() extends
+	uint8_t open_token;
+	bool owned;
+	bool overflow;
 };
 
 class Barf {
 public:
-	Barf(Stream &serial, jString ssid, jString password, int baud_rate, bool allow_gpio);
+	// Strings are taken as StrViews here and throughout, so literals,
+	// buffers and jStrings are passed without being copied
+	Barf(Stream &serial, const StrView &ssid, const StrView &password, unsigned long baud_rate, bool allow_gpio);
+
+	// Lets init() move the link to the fastest rate of BARF_BAUD_LADDER
+	// both sides can manage. Must be set before init().
+	void set_baud_switch(BaudSwitch baud_switch, void *context);
+	// Keeps init() from switching the link to binary frames or asking for
+	// flow control, for sketches that also talk to the firmware in text
+	// and read its output themselves, like the passthrough example. Must
+	// be set before init().
+	void set_text_only(bool text_only);
 
 	void init();
 	void connect();
@@ -40,28 +244,187 @@ public:
 	bool is_connected();
 	void set_led_mode(int mode);
 	jString debug_info();
-	void send_command(jString command, jString value);
-	void send_command(jString command);
-	void send_data(jString data);
+	void send_command(const StrView &command, const StrView &value);
+	void send_command(const StrView &command);
+	// Sends value straight from flash, as given by F()
+	void send_command(const StrView &command, const __FlashStringHelper *value);
+	// Sends the whole reply to a served request, which ends at the first
+	// newline. Use a ResponseWriter for anything larger.
+	void send_data(const StrView &data);
+	void send_data(const __FlashStringHelper *data);
 	void get_command_value(jString &command, jString &value);
 	jString get_ip();
-	jString read_line(jString expected_command, unsigned long timeout);
-	jString read_line(jString expected_command);
+	jString read_line(const StrView &expected_command, unsigned long timeout);
+	jString read_line(const StrView &expected_command);
 	jString read_line(unsigned long timeout);
 	jString read_line();
 
-	jString get_or_post(jString command, jString url);
-	jString get(jString url);
-	jString post(jString url);
+	// All versions of get/post fill in info, if given, with the status and
+	// length the response came with
+	jString get_or_post(const StrView &command, const StrView &url, ResponseInfo *info = nullptr);
+	jString get(const StrView &url, ResponseInfo *info = nullptr);
+	jString post(const StrView &url, ResponseInfo *info = nullptr);
+
+	// Streaming versions, the body is passed to sink without being stored.
+	// Return false if the response timed out.
+	bool get_or_post(const StrView &command, const StrView &url, BodySink sink, void *context, ResponseInfo *info = nullptr);
+	bool get(const StrView &url, BodySink sink, void *context, ResponseInfo *info = nullptr);
+	bool post(const StrView &url, BodySink sink, void *context, ResponseInfo *info = nullptr);
+
+	// Collect at most size - 1 bytes of the body into buffer, which is
+	// always null terminated. Return the length of the whole body, like
+	// snprintf() size or more if it was cut short, or -1 on timeout.
+	int32_t get_or_post(const StrView &command, const StrView &url, char *buffer, uint32_t size, ResponseInfo *info = nullptr);
+	int32_t get(const StrView &url, char *buffer, uint32_t size, ResponseInfo *info = nullptr);
+	int32_t post(const StrView &url, char *buffer, uint32_t size, ResponseInfo *info = nullptr);
+
+	// Start a request without waiting for the response, which is passed to
+	// sink as it arrives while run() or response_state() are called. Up to
+	// BARF_MAX_ASYNC_REQUESTS can be in flight at once, -1 is returned if
+	// there is no room for another. If done is given it is called once the
+	// request completes and the handle is released right after.
+	ResponseHandle get_async(const StrView &url, BodySink sink, void *context, ResponseCallback done = nullptr);
+	ResponseHandle post_async(const StrView &url, BodySink sink, void *context, ResponseCallback done = nullptr);
+
+	// Handles pending input and returns the state of a request started
+	// without a callback. The handle is released once this returns
+	// RESPONSE_DONE or RESPONSE_TIMEOUT.
+	ResponseState response_state(ResponseHandle handle);
 
+	// Routes requests with a matching method and path to handler, see
+	// Router::add(). run() calls the handler and returns a null request
+	// for them.
+	bool on(const char *method, const char *pattern, RouteHandler handler);
 
 	Request run();
+	// Fills in request with the next request without building a Request,
+	// or clears it and returns false if there is none. Routes added with
+	// on() are not consulted.
+	bool run(CompactRequest &request);
+
+#if BARF_STATS
+	const BarfStats &stats() const { return statistics; }
+#endif
 
 private:
+	friend class ResponseWriter;
+	friend class RequestBody;
+
+	enum ParseState {
+		PARSE_IDLE,
+		PARSE_REQUEST,
+		PARSE_GET_VALUE,
+		// The var didn't fit, so its value is dropped too
+		PARSE_SKIP_VALUE
+	};
+
+	void negotiate_baud_rate();
+	bool try_baud_rate(unsigned long rate);
+	bool check_baud_rate();
+	void negotiate_framing();
+	void negotiate_flow_control();
+	void negotiate_body_framing();
+	uint16_t receive();
+	void grant_credit();
+	void send_head(uint8_t opcode, uint32_t length);
+	void send_message(uint8_t opcode, const StrView &value, const StrView &rest = StrView());
+	void send_split_message(uint8_t opcode, const StrView &value, const StrView &rest, uint32_t length);
+	void send_message_P(uint8_t opcode, const char *value);
+	void write_P(const char *data, uint32_t length);
+	void send_reply_chunk(const uint8_t *data, uint16_t length);
+	void send_reply_chunk_P(const char *data, uint16_t length);
+	bool take_message(BarfMessage &message);
+	bool read_text_body(ResponseParser &parser, BodySink sink, void *context);
+	uint32_t take_body(char *buffer, uint32_t size);
+	void skip_body();
+	uint32_t read_body(char *buffer, uint32_t size);
+	bool wait_message(BarfMessage &message, unsigned long timeout);
+	bool parse_request_message(const BarfMessage &message);
+	void reset_request();
+	CompactRequest *next_request();
+	void release_request();
+
+	bool request_waiting() const;
+	void pump(bool keep_body);
+	void dispatch(const BarfMessage &message);
+#if BARF_STATS
+	void record_request();
+	void record_round_trip(unsigned long ms);
+#endif
+
+	ResponseHandle start_async(uint8_t opcode, const StrView &url, BodySink sink, void *context, ResponseCallback done);
+	ResponseHandle handle_async_message(const BarfMessage &message);
+	void async_data(ResponseHandle handle, const StrView &data);
+	void finish_async(ResponseHandle handle, ResponseState state);
+
+	struct AsyncRequest {
+		ResponseState state;
+		uint8_t id;
+		bool headers_finished;
+		// A body line of a text response ended, its newline is still due
+		bool line_pending;
+		BodySink sink;
+		void *context;
+		ResponseCallback done;
+		unsigned long started;
+	};
+
 	jString ssid;
 	jString password;
-	int baud_rate;
+	// Rate the link currently runs at
+	unsigned long baud_rate;
+	unsigned long initial_baud_rate;
+	// Rates of the ladder that were refused or failed the check
+	uint8_t baud_failures;
+	BaudSwitch baud_switch;
+	void *baud_switch_context;
 	int led_mode;
 	bool allow_gpio;
 	Stream &ser;
+	bool text_only;
+	bool binary_framing;
+	bool flow_control;
+	// Whether get/post bodies end by their length rather than response_end
+	bool body_framing;
+	// Bytes the firmware may still send without more credit
+	uint16_t credit;
+
+	Router router;
+
+	// State of the incoming request parser, kept between calls to run()
+	ParseState parse_state;
+	CompactRequest pending_request;
+	RxBuffer rx;
+	// Set while the rest of an over-long line is being skipped, or passed
+	// on to rx_async_line if it is a line of an async response, or to
+	// pending_request if rx_request_token is set
+	bool rx_skip_line;
+	ResponseHandle rx_async_line;
+	bool rx_request_token;
+	unsigned long last_rx;
+	// Completed requests waiting to be returned by run(). Their buffers are
+	// handed back and forth with pending_request, so once they are large
+	// enough parsing doesn't allocate.
+	CompactRequest request_queue[BARF_REQUEST_QUEUE_SIZE];
+	uint8_t request_queue_head;
+	uint8_t request_queue_count;
+
+	// Bytes of a request body still ahead in the receive stream, and of
+	// the BODY frame being read
+	uint32_t body_remaining;
+	uint16_t body_frame_remaining;
+	// Queue slot of the request the body belongs to while it waits there,
+	// -1 once it has been returned by run() or dropped
+	int8_t body_slot;
+	// Set while the request last returned by run() can read its body
+	bool body_readable;
+
+	AsyncRequest async_requests[BARF_MAX_ASYNC_REQUESTS];
+	uint8_t next_async_id;
+
+#if BARF_STATS
+	BarfStats statistics;
+	// Time spent parsing the pending request so far, in us
+	uint32_t pending_parse_time;
+#endif
 };
@@ -0,0 +1,237 @@
+#include "barf.h"
+
+CompactRequest::CompactRequest() {
+	buffer = nullptr;
+	capacity = 0;
+	owned = true;
+	clear();
+}
+
+CompactRequest::CompactRequest(char *buffer, uint16_t size) {
+	this->buffer = buffer;
+	capacity = size;
+	owned = false;
+	clear();
+}
+
+CompactRequest::~CompactRequest() {
+	if (owned) {
+		barf_free(buffer);
+	}
+}
+
+void CompactRequest::clear() {
+	used = 0;
+	token_count = 0;
+	num_fragments = 0;
+	num_vars = 0;
+	open_token = NO_TOKEN;
+	overflow = false;
+	body = RequestBody();
+}
+
+CompactRequest::Token CompactRequest::token(uint8_t index) const {
+	// The index grows down from the end of the buffer, which need not be
+	// aligned for a caller-supplied one
+	Token entry;
+	memcpy(&entry, buffer + capacity - (index + 1) * sizeof(Token), sizeof(Token));
+	return entry;
+}
+
+StrView CompactRequest::token_view(uint8_t index) const {
+	if (index >= token_count) {
+		return StrView();
+	}
+	Token entry = token(index);
+	return StrView(buffer + entry.offset, entry.length);
+}
+
+StrView CompactRequest::method() const {
+	return token_view(0);
+}
+
+StrView CompactRequest::fragment(uint8_t index) const {
+	return index < num_fragments ? token_view(1 + index) : StrView();
+}
+
+StrView CompactRequest::var_name(uint8_t index) const {
+	return index < num_vars ? token_view(1 + num_fragments + 2 * index) : StrView();
+}
+
+StrView CompactRequest::var_value(uint8_t index) const {
+	return index < num_vars ? token_view(2 + num_fragments + 2 * index) : StrView();
+}
+
+bool CompactRequest::get_var(const StrView &name, StrView &value) const {
+	for (uint8_t i = num_vars; i > 0; --i) {
+		if (var_name(i - 1) == name) {
+			value = var_value(i - 1);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool CompactRequest::reserve(uint32_t length, uint8_t tokens) {
+	// Makes room for length bytes of text and tokens more index entries
+	if (token_count + tokens > 0xff) {
+		overflow = true;
+		return false;
+	}
+
+	uint32_t needed = used + length + (token_count + tokens) * sizeof(Token);
+	if (needed <= capacity) {
+		return true;
+	}
+	if (!owned || needed > 0xffff) {
+		overflow = true;
+		return false;
+	}
+
+	uint32_t size = capacity ? capacity : BARF_REQUEST_BUFFER_SIZE;
+	while (size < needed) {
+		size *= 2;
+	}
+	if (size > 0xffff) {
+		size = 0xffff;
+	}
+
+	char *grown = (char *) barf_realloc(buffer, size);
+	if (!grown) {
+		overflow = true;
+		return false;
+	}
+
+	// The index moves along to the new end of the buffer
+	uint16_t index_size = token_count * sizeof(Token);
+	memmove(grown + size - index_size, grown + capacity - index_size, index_size);
+	buffer = grown;
+	capacity = size;
+	return true;
+}
+
+void CompactRequest::set_token(uint8_t index, const StrView &text) {
+	// Text goes after what is already there, a token that is set again
+	// leaves its old text behind
+	Token entry = {used, (uint16_t) text.length()};
+	memcpy(buffer + used, text.data(), text.length());
+	used += text.length();
+	memcpy(buffer + capacity - (index + 1) * sizeof(Token), &entry, sizeof(Token));
+	open_token = index;
+}
+
+bool CompactRequest::push_token(const StrView &text) {
+	if (!reserve(text.length(), 1)) {
+		return false;
+	}
+	set_token(token_count++, text);
+	return true;
+}
+
+void CompactRequest::set_method(const StrView &method) {
+	clear();
+	push_token(method);
+}
+
+void CompactRequest::add_fragment(const StrView &fragment) {
+	open_token = NO_TOKEN;
+	if (token_count && !num_vars && push_token(fragment)) {
+		num_fragments++;
+	}
+}
+
+bool CompactRequest::add_var(const StrView &name) {
+	open_token = NO_TOKEN;
+	if (!token_count || !reserve(name.length(), 2)) {
+		return false;
+	}
+	set_token(token_count++, name);
+	set_token(token_count++, StrView());
+	num_vars++;
+	// The rest of a long name goes to the name, not the empty value
+	open_token = token_count - 2;
+	return true;
+}
+
+void CompactRequest::set_var_value(const StrView &value) {
+	open_token = NO_TOKEN;
+	if (num_vars && reserve(value.length(), 0)) {
+		set_token(token_count - 1, value);
+	}
+}
+
+void CompactRequest::append(const StrView &text) {
+	if (open_token == NO_TOKEN) {
+		return;
+	}
+	if (!reserve(text.length(), 0)) {
+		// What arrived so far stays, truncated() tells it is incomplete
+		open_token = NO_TOKEN;
+		return;
+	}
+
+	Token entry = token(open_token);
+	memcpy(buffer + used, text.data(), text.length());
+	used += text.length();
+	entry.length += text.length();
+	memcpy(buffer + capacity - (open_token + 1) * sizeof(Token), &entry, sizeof(Token));
+
+	// Only the empty value of a var can follow the open token, it moves
+	// along to the end of the text
+	for (uint8_t i = open_token + 1; i < token_count; ++i) {
+		Token empty = {used, 0};
+		memcpy(buffer + capacity - (i + 1) * sizeof(Token), &empty, sizeof(Token));
+	}
+}
+
+void CompactRequest::assign(const CompactRequest &other) {
+	if (other.is_null()) {
+		clear();
+	} else {
+		set_method(other.method());
+	}
+	for (uint8_t i = 0; i < other.num_fragments; ++i) {
+		add_fragment(other.fragment(i));
+	}
+	for (uint8_t i = 0; i < other.num_vars; ++i) {
+		if (add_var(other.var_name(i))) {
+			set_var_value(other.var_value(i));
+		}
+	}
+	overflow = overflow || other.overflow;
+	body = other.body;
+}
+
+void CompactRequest::swap(CompactRequest &other) {
+	jsonic::containers::swap(buffer, other.buffer);
+	jsonic::containers::swap(capacity, other.capacity);
+	jsonic::containers::swap(used, other.used);
+	jsonic::containers::swap(token_count, other.token_count);
+	jsonic::containers::swap(num_fragments, other.num_fragments);
+	jsonic::containers::swap(num_vars, other.num_vars);
+	jsonic::containers::swap(open_token, other.open_token);
+	jsonic::containers::swap(overflow, other.overflow);
+	jsonic::containers::swap(body, other.body);
+}
+
+void CompactRequest::take(CompactRequest &other) {
+	if (owned && other.owned) {
+		swap(other);
+	} else {
+		assign(other);
+	}
+	other.clear();
+}
+
+Request CompactRequest::to_request() const {
+	Request request;
+	request.method = method().to_string();
+	for (uint8_t i = 0; i < num_fragments; ++i) {
+		request.fragments.push_back(fragment(i).to_string());
+	}
+	for (uint8_t i = 0; i < num_vars; ++i) {
+		request.add_var(var_name(i).to_string(), var_value(i).to_string());
+	}
+	request.body = body;
+	return request;
+}
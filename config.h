@@ -0,0 +1,132 @@
+// Compile-time configuration of the barf library. Every setting can be
+// overridden by defining it before this file is included.
+#pragma once
+
+// Back jString, Vector and HashMap by std::string, std::vector and
+// std::unordered_map (see jsonic/containers.h). Done by default on boards
+// that have the memory and a full standard library, can be switched on
+// anywhere else by defining USE_STL.
+#if !defined(USE_STL) && defined(ARDUINO_ARCH_ESP32)
+#define USE_STL
+#endif
+
+// Size of the receive ring buffer that incoming lines are framed in.
+// Lines longer than this are handed out in buffer-sized pieces.
+#ifndef BARF_RX_BUFFER_SIZE
+#define BARF_RX_BUFFER_SIZE 128
+#endif
+
+// Baud rates init() offers the firmware, fastest first, when the sketch
+// has set a switch function with Barf::set_baud_switch(). The first one
+// that is accepted and passes the echo check is kept; rates no faster than
+// the one the link was opened at are not tried.
+#ifndef BARF_BAUD_LADDER
+#define BARF_BAUD_LADDER 115200, 57600, 38400, 19200
+#endif
+
+// How long the library waits for the echo check after switching, in ms.
+// The firmware waits twice as long for the confirmation.
+#ifndef BARF_BAUD_CHECK_TIMEOUT
+#define BARF_BAUD_CHECK_TIMEOUT 500
+#endif
+
+// Whether init() offers binary framing to the firmware. Firmware that
+// doesn't answer within BARF_FRAMING_TIMEOUT ms keeps the text protocol.
+#ifndef BARF_BINARY_FRAMING
+#define BARF_BINARY_FRAMING 1
+#endif
+
+#ifndef BARF_FRAMING_TIMEOUT
+#define BARF_FRAMING_TIMEOUT 500
+#endif
+
+// How long debug_info() waits for each debug line of the firmware, in ms
+#ifndef BARF_DEBUG_TIMEOUT
+#define BARF_DEBUG_TIMEOUT 100
+#endif
+
+// Whether init() asks the firmware for credit based flow control, see
+// constants.h. Firmware that doesn't answer within BARF_FRAMING_TIMEOUT ms
+// sends unpaced as before.
+#ifndef BARF_FLOW_CONTROL
+#define BARF_FLOW_CONTROL 1
+#endif
+
+// Most bytes the firmware may have in flight. Keeping this below the size
+// of the serial port's own receive buffer (63 bytes usable on AVR) means
+// nothing is dropped even when the sketch doesn't read for a long time.
+#ifndef BARF_FLOW_WINDOW
+#define BARF_FLOW_WINDOW 63
+#endif
+
+// Largest response body get() and post() collect into a string, anything
+// beyond is dropped and ResponseInfo::truncated set. Use the sink versions
+// to handle larger bodies.
+#ifndef BARF_MAX_RESPONSE_SIZE
+#define BARF_MAX_RESPONSE_SIZE 1024
+#endif
+
+// How many completed requests are kept for run() to return. Requests that
+// arrive while the sketch waits for a reply are queued here; once the queue
+// is full, run() leaves further input in the receive buffer, and blocking
+// calls drop requests that don't fit.
+#ifndef BARF_REQUEST_QUEUE_SIZE
+#define BARF_REQUEST_QUEUE_SIZE 2
+#endif
+
+// Initial size of the buffer a CompactRequest allocates, see barf.h. It
+// doubles whenever a request doesn't fit and is kept for the next one.
+#ifndef BARF_REQUEST_BUFFER_SIZE
+#define BARF_REQUEST_BUFFER_SIZE 64
+#endif
+
+// How many get_async()/post_async() requests can be in flight at once
+#ifndef BARF_MAX_ASYNC_REQUESTS
+#define BARF_MAX_ASYNC_REQUESTS 4
+#endif
+
+// Bytes a ResponseWriter collects before sending them as a reply chunk.
+// Writes at least this large go out directly without being copied.
+#ifndef BARF_REPLY_BUFFER_SIZE
+#define BARF_REPLY_BUFFER_SIZE 64
+#endif
+
+// Capacity of the route table. Every method and path segment of a route
+// takes a node, routes share nodes for common prefixes.
+#ifndef BARF_MAX_ROUTE_NODES
+#define BARF_MAX_ROUTE_NODES 16
+#endif
+
+// Most :parameters a single route can capture
+#ifndef BARF_MAX_ROUTE_PARAMS
+#define BARF_MAX_ROUTE_PARAMS 4
+#endif
+
+// Size in bytes of the request arena. When non-zero, the strings and
+// vectors of the Request a route handler is called with come from a static
+// bump arena that is reset wholesale once the handler returns, so routed
+// requests don't fragment the heap. Allocations that don't fit fall back
+// to the heap. Requests run() returns to the sketch are built on the heap
+// and stay valid for as long as the sketch keeps them.
+#ifndef BARF_ARENA_SIZE
+#define BARF_ARENA_SIZE 0
+#endif
+
+// Keep the counters of BarfStats, see Barf::stats(). Without this they
+// don't take any memory or time.
+#ifndef BARF_STATS
+#define BARF_STATS 0
+#endif
+
+// Track heap usage by call site, see barf_heap_usage(). Every heap block
+// gets a small header to remember its size, so this is meant for sizing
+// arenas and finding leaks, and for benchmarks.
+#ifndef BARF_HEAP_TRACKING
+#define BARF_HEAP_TRACKING 0
+#endif
+
+// Largest block barf_largest_free_block() tries to allocate where it can't
+// look at the heap directly
+#ifndef BARF_HEAP_PROBE_LIMIT
+#define BARF_HEAP_PROBE_LIMIT 32768
+#endif
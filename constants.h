@@ -21,8 +21,17 @@
 #define COMMAND_GET_VAR "get_var"
 #define COMMAND_GET_VALUE "get_value"
 #define COMMAND_REQUEST_RESPONSE "respond"
+// The response to get/post starts with "response_start", then comes the
+// head of the HTTP response a line at a time up to an empty line, and the
+// body as it was sent: exactly Content-Length bytes, or chunked encoding if
+// there is no length. In text mode the body follows the empty line raw,
+// with frames it is carried by RESPONSE_HEADER and RESPONSE_DATA frames.
+// Firmware that does this answers "body_framing 1" from init() with
+// "body_framing 1". Older firmware doesn't answer, and sends the body line
+// by line (or in data frames) followed by "response_end".
 #define COMMAND_RESPONSE_START "response_start"
 #define COMMAND_RESPONSE_END "response_end"
+#define COMMAND_BODY_FRAMING "body_framing"
 
 #define COMMAND_SSID "ssid"
 #define COMMAND_PASSWORD "password"
@@ -35,5 +44,244 @@
 #define COMMAND_ALLOW_GPIO "allow_gpio"
 #define COMMAND_DISALLOW_GPIO "disallow_gpio"
 #define COMMAND_BAUD_RATE "baud_rate"
+#define COMMAND_BAUD_CHECK "baud_check"
+#define COMMAND_BAUD_CONFIRM "baud_confirm"
 #define COMMAND_IS_CONNECTED "is_connected"
 #define COMMAND_GET_IP "get_ip"
+#define COMMAND_FRAMING "framing"
+
+// Baud rate negotiation. "baud_rate <rate>" is answered with "baud_rate 1"
+// if the firmware can run at that rate, after which both sides switch.
+// The library then sends "baud_check <BAUD_CHECK_PATTERN>" at the new rate
+// and the firmware echoes it. If the echo comes back intact within
+// BARF_BAUD_CHECK_TIMEOUT ms the library keeps the rate and sends
+// "baud_confirm", otherwise it goes back to the previous rate. So does
+// firmware that isn't sent "baud_confirm" within 2 * BARF_BAUD_CHECK_TIMEOUT
+// ms of switching, so neither side stays at a rate the other has left.
+#define BAUD_CHECK_PATTERN "U5U5~!0a"
+
+// Flow control. "flow_control <credit>" is answered with "flow_control 1"
+// by firmware that supports it. From the byte after that answer on, the
+// firmware sends no more than it has credit for: the initial credit plus
+// the values of all "credit <bytes>" commands since, counting every byte
+// of every line or frame. The library grants credit as its receive buffer
+// drains, so it can't be overrun however slowly it reads.
+#define COMMAND_FLOW_CONTROL "flow_control"
+#define COMMAND_CREDIT "credit"
+
+// Asynchronous get/post. The value of each of these starts with the request
+// id the library picked, "async_get <id> <url>" is answered by
+// "async_start <id>", the response as "async_line <id> <line>" lines (or
+// header and data frames), and "async_end <id>". Responses to different
+// ids can arrive interleaved. In text mode the body follows the empty line
+// after the head, one line per line of the body. The last one is what
+// comes after the last newline, an empty line if the body ends in one.
+#define COMMAND_ASYNC_GET "async_get"
+#define COMMAND_ASYNC_POST "async_post"
+#define COMMAND_ASYNC_START "async_start"
+#define COMMAND_ASYNC_LINE "async_line"
+#define COMMAND_ASYNC_END "async_end"
+
+// Streamed replies to served requests, an alternative to a single response
+// line. "reply_begin <status>" is followed by any number of
+// "reply_header <Name: value>" and "reply_chunk <length>" commands and
+// finally "reply_end". In text mode the line of a reply_chunk is followed by
+// exactly <length> raw bytes, as frames its payload is the bytes. A chunk
+// carries at most REPLY_CHUNK_MAX bytes. The firmware passes the reply on
+// to the client with chunked transfer encoding.
+#define COMMAND_REPLY_BEGIN "reply_begin"
+#define COMMAND_REPLY_HEADER "reply_header"
+#define COMMAND_REPLY_CHUNK "reply_chunk"
+#define COMMAND_REPLY_END "reply_end"
+#define REPLY_CHUNK_MAX 1024
+
+// Bodies of served requests. "body_length <length>" comes among the other
+// parts of a request with a body, before respond. Right after respond the
+// body follows as <length> raw bytes in text mode, or split into BODY
+// frames.
+#define COMMAND_BODY_LENGTH "body_length"
+
+// Binary framing, negotiated with the framing command. The library sends
+// "framing <max payload>" in text, the firmware answers "framing 1" and
+// from then on both sides only send frames:
+//   opcode (1 byte, high bit set) | payload length (2 bytes, little endian) | payload
+// Every command has an opcode whose payload is the command's value. Body
+// data that can't be expressed as text lines has opcodes of its own.
+// A value longer than the receiver's max payload is split: every frame of
+// it but the last has FRAME_MORE set in its length, and all but the first
+// have the CONTINUATION opcode. Raw data is sent in frames that fit.
+#define FRAME_HEADER_SIZE 3
+#define FRAME_OP_FLAG 0x80
+#define FRAME_MORE 0x8000
+#define FRAME_MAX_PAYLOAD 0x7fff
+
+#define FRAME_OP_UNKNOWN 0x00
+#define FRAME_OP_LINE 0x80 // Payload is a whole text line
+#define FRAME_OP_DEBUG 0x81
+#define FRAME_OP_METHOD 0x82
+#define FRAME_OP_NUM_FRAMENTS 0x83
+#define FRAME_OP_PATH_FRAGMENT 0x84
+#define FRAME_OP_GET_VAR 0x85
+#define FRAME_OP_GET_VALUE 0x86
+#define FRAME_OP_REQUEST_RESPONSE 0x87
+#define FRAME_OP_RESPONSE_START 0x88
+#define FRAME_OP_RESPONSE_END 0x89
+#define FRAME_OP_SSID 0x8a
+#define FRAME_OP_PASSWORD 0x8b
+#define FRAME_OP_CONNECT 0x8c
+#define FRAME_OP_DISCONNECT 0x8d
+#define FRAME_OP_TIMEOUT 0x8e
+#define FRAME_OP_LED_MODE 0x8f
+#define FRAME_OP_GET 0x90
+#define FRAME_OP_POST 0x91
+#define FRAME_OP_ALLOW_GPIO 0x92
+#define FRAME_OP_DISALLOW_GPIO 0x93
+#define FRAME_OP_BAUD_RATE 0x94
+#define FRAME_OP_IS_CONNECTED 0x95
+#define FRAME_OP_GET_IP 0x96
+#define FRAME_OP_FRAMING 0x97
+#define FRAME_OP_DATA 0x98 // Response to a request served by the sketch
+#define FRAME_OP_RESPONSE_HEADER 0x99 // One header line of a get/post response
+#define FRAME_OP_RESPONSE_DATA 0x9a // Raw body bytes of a get/post response
+#define FRAME_OP_ASYNC_GET 0x9b
+#define FRAME_OP_ASYNC_POST 0x9c
+#define FRAME_OP_ASYNC_START 0x9d
+#define FRAME_OP_ASYNC_LINE 0x9e
+#define FRAME_OP_ASYNC_END 0x9f
+#define FRAME_OP_ASYNC_HEADER 0xa0 // "<id> <header line>" of an async response
+#define FRAME_OP_ASYNC_DATA 0xa1 // "<id> <raw body bytes>" of an async response
+#define FRAME_OP_BAUD_CHECK 0xa2
+#define FRAME_OP_FLOW_CONTROL 0xa3
+#define FRAME_OP_CREDIT 0xa4
+#define FRAME_OP_REPLY_BEGIN 0xa5
+#define FRAME_OP_REPLY_HEADER 0xa6
+#define FRAME_OP_REPLY_CHUNK 0xa7
+#define FRAME_OP_REPLY_END 0xa8
+#define FRAME_OP_BODY_LENGTH 0xa9
+#define FRAME_OP_BODY 0xaa // Raw bytes of a served request's body
+#define FRAME_OP_BAUD_CONFIRM 0xab
+#define FRAME_OP_BODY_FRAMING 0xac
+#define FRAME_OP_CONTINUATION 0xad // More of the payload of the frame before
+// Opcodes are numbered without gaps up to this one
+#define FRAME_OP_LAST FRAME_OP_CONTINUATION
+
+#include <stdint.h>
+#include <string.h>
+
+inline void frame_write_header(uint8_t *header, uint8_t opcode, uint16_t length, bool more = false) {
+	if (more) {
+		length |= FRAME_MORE;
+	}
+	header[0] = opcode;
+	header[1] = length & 0xff;
+	header[2] = length >> 8;
+}
+
+inline uint16_t frame_read_length(const uint8_t *header) {
+	return (header[1] | (uint16_t(header[2]) << 8)) & ~FRAME_MORE;
+}
+
+inline bool frame_has_more(const uint8_t *header) {
+	return header[2] & (FRAME_MORE >> 8);
+}
+
+inline bool frame_opcode_known(uint8_t opcode) {
+	return (opcode & FRAME_OP_FLAG) && opcode <= FRAME_OP_LAST;
+}
+
+// Every command with its opcode. This one table gives both the text of an
+// opcode and the opcode of a text command, so the two can't disagree.
+#define BARF_COMMANDS(X) \
+	X(FRAME_OP_DEBUG, COMMAND_DEBUG) \
+	X(FRAME_OP_METHOD, COMMAND_METHOD) \
+	X(FRAME_OP_NUM_FRAMENTS, COMMAND_NUM_FRAMENTS) \
+	X(FRAME_OP_PATH_FRAGMENT, COMMAND_PATH_FRAGMENT) \
+	X(FRAME_OP_GET_VAR, COMMAND_GET_VAR) \
+	X(FRAME_OP_GET_VALUE, COMMAND_GET_VALUE) \
+	X(FRAME_OP_REQUEST_RESPONSE, COMMAND_REQUEST_RESPONSE) \
+	X(FRAME_OP_RESPONSE_START, COMMAND_RESPONSE_START) \
+	X(FRAME_OP_RESPONSE_END, COMMAND_RESPONSE_END) \
+	X(FRAME_OP_SSID, COMMAND_SSID) \
+	X(FRAME_OP_PASSWORD, COMMAND_PASSWORD) \
+	X(FRAME_OP_CONNECT, COMMAND_CONNECT) \
+	X(FRAME_OP_DISCONNECT, COMMAND_DISCONNECT) \
+	X(FRAME_OP_TIMEOUT, COMMAND_TIMEOUT) \
+	X(FRAME_OP_LED_MODE, COMMAND_LED_MODE) \
+	X(FRAME_OP_GET, COMMAND_GET) \
+	X(FRAME_OP_POST, COMMAND_POST) \
+	X(FRAME_OP_ALLOW_GPIO, COMMAND_ALLOW_GPIO) \
+	X(FRAME_OP_DISALLOW_GPIO, COMMAND_DISALLOW_GPIO) \
+	X(FRAME_OP_BAUD_RATE, COMMAND_BAUD_RATE) \
+	X(FRAME_OP_IS_CONNECTED, COMMAND_IS_CONNECTED) \
+	X(FRAME_OP_GET_IP, COMMAND_GET_IP) \
+	X(FRAME_OP_FRAMING, COMMAND_FRAMING) \
+	X(FRAME_OP_ASYNC_GET, COMMAND_ASYNC_GET) \
+	X(FRAME_OP_ASYNC_POST, COMMAND_ASYNC_POST) \
+	X(FRAME_OP_ASYNC_START, COMMAND_ASYNC_START) \
+	X(FRAME_OP_ASYNC_LINE, COMMAND_ASYNC_LINE) \
+	X(FRAME_OP_ASYNC_END, COMMAND_ASYNC_END) \
+	X(FRAME_OP_BAUD_CHECK, COMMAND_BAUD_CHECK) \
+	X(FRAME_OP_FLOW_CONTROL, COMMAND_FLOW_CONTROL) \
+	X(FRAME_OP_CREDIT, COMMAND_CREDIT) \
+	X(FRAME_OP_REPLY_BEGIN, COMMAND_REPLY_BEGIN) \
+	X(FRAME_OP_REPLY_HEADER, COMMAND_REPLY_HEADER) \
+	X(FRAME_OP_REPLY_CHUNK, COMMAND_REPLY_CHUNK) \
+	X(FRAME_OP_REPLY_END, COMMAND_REPLY_END) \
+	X(FRAME_OP_BODY_LENGTH, COMMAND_BODY_LENGTH) \
+	X(FRAME_OP_BAUD_CONFIRM, COMMAND_BAUD_CONFIRM) \
+	X(FRAME_OP_BODY_FRAMING, COMMAND_BODY_FRAMING)
+
+// Commands are told apart by a hash of their text, which is perfect for the
+// commands above. If a new command collides with another, the static_assert
+// below fails and COMMAND_HASH_SEED needs changing to one that separates
+// them all again.
+#define COMMAND_HASH_SEED 13
+
+constexpr uint8_t command_hash(const char *text, uint16_t length, uint8_t hash = COMMAND_HASH_SEED) {
+	return length ? command_hash(text + 1, length - 1, uint8_t((hash * 3) ^ uint8_t(*text))) : hash;
+}
+
+constexpr bool command_hash_unique(uint8_t) {
+	return true;
+}
+
+template<typename... Hashes>
+constexpr bool command_hash_unique(uint8_t hash, uint8_t other, Hashes... rest) {
+	return hash != other && command_hash_unique(hash, rest...);
+}
+
+constexpr bool command_hashes_unique(int) {
+	return true;
+}
+
+template<typename... Hashes>
+constexpr bool command_hashes_unique(int, uint8_t hash, Hashes... rest) {
+	return command_hash_unique(hash, rest...) && command_hashes_unique(0, rest...);
+}
+
+#define COMMAND_HASH_ARGUMENT(opcode, name) , command_hash(name, sizeof(name) - 1)
+static_assert(command_hashes_unique(0 BARF_COMMANDS(COMMAND_HASH_ARGUMENT)), "Two commands have the same hash, change COMMAND_HASH_SEED");
+#undef COMMAND_HASH_ARGUMENT
+
+// Text command for an opcode, empty for opcodes that only exist as frames
+inline const char *frame_command_name(uint8_t opcode) {
+	switch (opcode) {
+#define COMMAND_NAME_CASE(opcode, name) case opcode: return name;
+		BARF_COMMANDS(COMMAND_NAME_CASE)
+#undef COMMAND_NAME_CASE
+		default: return "";
+	}
+}
+
+// Opcode for a text command, FRAME_OP_UNKNOWN if there is none. The hash
+// picks the only command it can be, which is then compared once.
+inline uint8_t frame_opcode(const char *command, uint16_t length) {
+	switch (command_hash(command, length)) {
+#define COMMAND_HASH_CASE(opcode, name) \
+		case command_hash(name, sizeof(name) - 1): \
+			return length == sizeof(name) - 1 && memcmp(name, command, length) == 0 ? opcode : FRAME_OP_UNKNOWN;
+		BARF_COMMANDS(COMMAND_HASH_CASE)
+#undef COMMAND_HASH_CASE
+		default: return FRAME_OP_UNKNOWN;
+	}
+}
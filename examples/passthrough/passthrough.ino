@@ -18,6 +18,10 @@ void setup() {
 	pinMode(13, OUTPUT);
 	digitalWrite(13, HIGH);
 
+	// What is typed goes to the firmware as it is and its output is read
+	// straight from the port, so the link has to stay in text without
+	// flow control
+	barf.set_text_only(true);
 	barf.init();
 	barf.connect();
 
@@ -14,12 +14,41 @@ String to_arduino_string(jString s) {
 	return String(s.c_str());
 }
 
+// Lets init() move the link to a faster baud rate
+void switch_baud(unsigned long baud_rate, void *context) {
+	BARF_SERIAL.begin(baud_rate);
+}
+
+// Handles GET /led/<state>, everything else ends up in loop()
+void set_led(Barf &barf, Request &request, const RouteParams &params) {
+	bool on = *params.get("state") == "on";
+	digitalWrite(13, on ? HIGH : LOW);
+	barf.send_data(on ? "led on" : "led off");
+}
+
+// Handles GET /status, the page stays in flash and is streamed out in chunks
+const char STATUS_PAGE[] PROGMEM = "<html>\n<body>\n<h1>Status</h1>\n<p>uptime ";
+
+void status(Barf &barf, Request &request, const RouteParams &params) {
+	ResponseWriter response(barf);
+	response.begin(200, "Content-Type: text/html");
+	response.write_P(STATUS_PAGE, sizeof(STATUS_PAGE) - 1);
+	// Seconds to the millisecond, without going through float
+	print_fixed(response, millis(), 3);
+	response.print(F("s</p>\n</body>\n</html>\n"));
+	response.end();
+}
+
 void setup() {
 	pinMode(13, OUTPUT);
 	CONSOLE_SERIAL.begin(9600);
 	BARF_SERIAL.begin(9600);
 	delay(1000);
 
+	barf.on("GET", "/led/:state", set_led);
+	barf.on("GET", "/status", status);
+	barf.set_baud_switch(switch_baud, nullptr);
+
 	barf.init();
 	barf.connect();
 
@@ -48,6 +77,6 @@ void loop() {
 			CONSOLE_SERIAL.println(to_arduino_string(request.get_vars[i].name) + String(" = ") + to_arduino_string(request.get_vars[i].value));
 		}
 
-		barf.send_data("response!");
+		barf.send_data(F("response!"));
 	}
 }
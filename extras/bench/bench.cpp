@@ -0,0 +1,305 @@
+// Benchmarks for the containers and the protocol hot paths, run on the
+// Linux host with the shims from extras/host. Build from the repository
+// root with
+//
+//   g++ -std=gnu++11 -O2 -DBARF_HEAP_TRACKING=1
+//       -Iextras/host -I. *.cpp extras/host/arduino.cpp
+//       extras/bench/bench.cpp -o barf_bench
+//
+// Every result is reported as time and allocations per operation, followed
+// by the peak heap usage of each call site. The container benchmarks run
+// against both jsonic and the std:: equivalents; building with -DUSE_STL as
+// well switches jsonic over to its STL backend.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <barf.h>
+
+static const char *WORDS[] = {"GET", "sensor", "temperature", "a", "some_longer_path_fragment", "42"};
+static const int WORD_COUNT = sizeof(WORDS) / sizeof(WORDS[0]);
+
+// Stream over a fixed input, output is thrown away
+class MemoryStream : public Stream {
+public:
+	void load(const std::string &data) {
+		input = data;
+		position = 0;
+	}
+
+	int available() { return input.size() - position; }
+	int read() { return position < input.size() ? (unsigned char) input[position++] : -1; }
+	int peek() { return position < input.size() ? (unsigned char) input[position] : -1; }
+
+	using Print::write;
+	size_t write(uint8_t) { return 1; }
+
+private:
+	std::string input;
+	size_t position;
+};
+
+// Runs body iterations times and prints time and allocations per
+// iteration, returns the time in ns
+template<typename F>
+static double measure(const char *name, unsigned long iterations, F body) {
+	// Warm up caches and the allocator
+	body();
+
+	unsigned long allocations = barf_allocation_count();
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	for (unsigned long i = 0; i < iterations; ++i) {
+		body();
+	}
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+	allocations = barf_allocation_count() - allocations;
+
+	printf("%-44s %12.1f ns/op %10.2f allocs/op\n", name, ns / iterations, double(allocations) / iterations);
+	return ns / iterations;
+}
+
+static volatile unsigned long sink;
+
+template<typename S>
+static void bench_string(const char *backend) {
+	char name[64];
+	S haystack("method GET path_frament sensor get_var temperature get_value 21.5");
+	S needle("get_value");
+	S short_string("GET");
+	S long_string("some_longer_path_fragment_that_does_not_fit_inline");
+
+	snprintf(name, sizeof(name), "%s string find", backend);
+	measure(name, 1000000, [&]() { sink += haystack.find(needle); });
+
+	snprintf(name, sizeof(name), "%s string substr", backend);
+	measure(name, 1000000, [&]() { sink += haystack.substr(7, 3).length(); });
+
+	snprintf(name, sizeof(name), "%s string insert", backend);
+	measure(name, 200000, [&]() {
+		S s(long_string);
+		s.insert(5, short_string);
+		sink += s.length();
+	});
+
+	snprintf(name, sizeof(name), "%s string operator+ short", backend);
+	measure(name, 1000000, [&]() { sink += (short_string + short_string).length(); });
+
+	snprintf(name, sizeof(name), "%s string operator+ long", backend);
+	measure(name, 1000000, [&]() { sink += (long_string + long_string).length(); });
+
+	snprintf(name, sizeof(name), "%s string push_back x64", backend);
+	measure(name, 100000, [&]() {
+		S s;
+		for (int i = 0; i < 64; ++i) {
+			s.push_back('x');
+		}
+		sink += s.length();
+	});
+}
+
+template<typename S, typename V>
+static void bench_vector(const char *backend) {
+	char name[64];
+	snprintf(name, sizeof(name), "%s vector<int> push_back x100", backend);
+	measure(name, 100000, [&]() {
+		V v;
+		for (int i = 0; i < 100; ++i) {
+			v.push_back(i);
+		}
+		sink += v.size();
+	});
+}
+
+template<typename S, typename V>
+static void bench_string_vector(const char *backend) {
+	char name[64];
+	snprintf(name, sizeof(name), "%s vector<string> push_back x20", backend);
+	measure(name, 100000, [&]() {
+		V v;
+		for (int i = 0; i < 20; ++i) {
+			v.push_back(S(WORDS[i % WORD_COUNT]));
+		}
+		sink += v.size();
+	});
+}
+
+template<typename S, typename M>
+static void bench_map(const char *backend, void (*insert)(M &, const S &, int)) {
+	char name[64];
+	std::vector<S> keys;
+	for (int i = 0; i < 64; ++i) {
+		char key[16];
+		snprintf(key, sizeof(key), "var_%d", i);
+		keys.push_back(S(key));
+	}
+
+	snprintf(name, sizeof(name), "%s map insert x64", backend);
+	measure(name, 20000, [&]() {
+		M map;
+		for (size_t i = 0; i < keys.size(); ++i) {
+			insert(map, keys[i], i);
+		}
+		sink += map.size();
+	});
+
+	M map;
+	for (size_t i = 0; i < keys.size(); ++i) {
+		insert(map, keys[i], i);
+	}
+	size_t next = 0;
+	snprintf(name, sizeof(name), "%s map lookup", backend);
+	measure(name, 1000000, [&]() {
+		sink += map.count(keys[next]);
+		next = (next + 1) % keys.size();
+	});
+}
+
+static void insert_jsonic(jsonic::containers::HashMap<jString, int> &map, const jString &key, int value) {
+	map.insert(key, value);
+}
+
+static void insert_std(std::unordered_map<std::string, int> &map, const std::string &key, int value) {
+	map[key] = value;
+}
+
+static std::string request_text(int fragments, int vars) {
+	std::string text = "method GET\nnum_fragments " + std::to_string(fragments) + "\n";
+	for (int i = 0; i < fragments; ++i) {
+		text += std::string("path_frament ") + WORDS[i % WORD_COUNT] + "\n";
+	}
+	for (int i = 0; i < vars; ++i) {
+		text += "get_var var_" + std::to_string(i) + "\nget_value " + WORDS[i % WORD_COUNT] + "\n";
+	}
+	return text + "respond\n";
+}
+
+static std::string frame(uint8_t opcode, const std::string &payload) {
+	uint8_t header[FRAME_HEADER_SIZE];
+	frame_write_header(header, opcode, payload.size());
+	return std::string((const char *) header, FRAME_HEADER_SIZE) + payload;
+}
+
+static std::string request_frames(int fragments, int vars) {
+	std::string frames = frame(FRAME_OP_METHOD, "GET") + frame(FRAME_OP_NUM_FRAMENTS, std::to_string(fragments));
+	for (int i = 0; i < fragments; ++i) {
+		frames += frame(FRAME_OP_PATH_FRAGMENT, WORDS[i % WORD_COUNT]);
+	}
+	for (int i = 0; i < vars; ++i) {
+		frames += frame(FRAME_OP_GET_VAR, "var_" + std::to_string(i)) + frame(FRAME_OP_GET_VALUE, WORDS[i % WORD_COUNT]);
+	}
+	return frames + frame(FRAME_OP_REQUEST_RESPONSE, "");
+}
+
+static void bench_protocol() {
+	// Command tokens as they start every text line, known and unknown
+	static const char *COMMANDS[] = {"method", "path_frament", "get_var", "get_value", "respond", "async_line", "credit", "<html>", "sensor"};
+	measure("frame_opcode x9", 200000, [&]() {
+		for (int i = 0; i < 9; ++i) {
+			sink += frame_opcode(COMMANDS[i], strlen(COMMANDS[i]));
+		}
+	});
+
+	static const unsigned long NUMBERS[] = {0, 7, 418, 9600, 65535, 115200, 1234567, 4000000000UL};
+	char text[NUMBER_TEXT_MAX];
+	measure("format_number x8", 200000, [&]() {
+		for (int i = 0; i < 8; ++i) {
+			sink += format_number(text, sizeof(text), NUMBERS[i]);
+		}
+	});
+	static const char *TEXTS[] = {"0", "7", "418", "9600", "65535", "115200", "1234567", "4000000000"};
+	measure("parse_number x8", 200000, [&]() {
+		for (int i = 0; i < 8; ++i) {
+			unsigned long number;
+			sink += parse_number(TEXTS[i], number);
+		}
+	});
+
+	MemoryStream stream;
+	Barf barf(stream, "ssid", "password", 115200, true);
+
+	// Replies, lines of requests would be dispatched rather than returned
+	std::string lines;
+	for (int i = 0; i < 1000; ++i) {
+		lines += std::string("get_ip ") + WORDS[i % WORD_COUNT] + "\n";
+	}
+	double ns = measure("read_line x1000", 1000, [&]() {
+		stream.load(lines);
+		while (stream.available()) {
+			sink += barf.read_line().length();
+		}
+	});
+	printf("%-44s %12.1f MB/s\n", "read_line throughput", lines.size() / ns * 1000);
+
+	int sizes[] = {0, 5, 10, 20};
+	for (int i = 0; i < 4; ++i) {
+		char name[64];
+		std::string text = request_text(sizes[i], sizes[i]);
+		snprintf(name, sizeof(name), "run() text, %d fragments + vars", sizes[i]);
+		measure(name, 20000, [&]() {
+			stream.load(text);
+			sink += barf.run().fragments.size();
+		});
+	}
+
+	CompactRequest compact;
+	for (int i = 0; i < 4; ++i) {
+		char name[64];
+		std::string text = request_text(sizes[i], sizes[i]);
+		snprintf(name, sizeof(name), "run(compact) text, %d fragments + vars", sizes[i]);
+		measure(name, 20000, [&]() {
+			stream.load(text);
+			barf.run(compact);
+			sink += compact.fragment_count();
+		});
+	}
+
+	// Switch to binary framing, which is offered after body framing
+	stream.load("body_framing 1\nframing 1\n");
+	barf.init();
+	if (!strstr(barf.debug_info().c_str(), "framing binary")) {
+		fprintf(stderr, "binary framing wasn't negotiated\n");
+		exit(1);
+	}
+	for (int i = 0; i < 4; ++i) {
+		char name[64];
+		std::string frames = request_frames(sizes[i], sizes[i]);
+		snprintf(name, sizeof(name), "run() frames, %d fragments + vars", sizes[i]);
+		measure(name, 20000, [&]() {
+			stream.load(frames);
+			sink += barf.run().fragments.size();
+		});
+	}
+	for (int i = 0; i < 4; ++i) {
+		char name[64];
+		std::string frames = request_frames(sizes[i], sizes[i]);
+		snprintf(name, sizeof(name), "run(compact) frames, %d fragments + vars", sizes[i]);
+		measure(name, 20000, [&]() {
+			stream.load(frames);
+			barf.run(compact);
+			sink += compact.fragment_count();
+		});
+	}
+}
+
+int main() {
+	bench_string<jString>("jsonic");
+	bench_string<std::string>("std");
+	bench_vector<jString, jsonic::containers::Vector<int> >("jsonic");
+	bench_vector<std::string, std::vector<int> >("std");
+	bench_string_vector<jString, jsonic::containers::Vector<jString> >("jsonic");
+	bench_string_vector<std::string, std::vector<std::string> >("std");
+	bench_map<jString, jsonic::containers::HashMap<jString, int> >("jsonic", insert_jsonic);
+	bench_map<std::string, std::unordered_map<std::string, int> >("std", insert_std);
+	bench_protocol();
+
+	static const char *TAGS[HEAP_TAG_COUNT] = {"other", "request", "get_or_post", "read_line"};
+	for (uint8_t tag = 0; tag < HEAP_TAG_COUNT; ++tag) {
+		HeapUsage usage = barf_heap_usage(tag);
+		printf("heap %-12s %8zu live %8zu peak %10lu allocations\n", TAGS[tag], usage.live, usage.peak, usage.allocations);
+	}
+	return 0;
+}
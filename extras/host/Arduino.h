@@ -0,0 +1,40 @@
+// Minimal stand-in for the Arduino core, enough to build the barf library
+// on a Linux host
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+// Flash memory is just memory on the host
+#define PROGMEM
+#define PGM_P const char *
+#define pgm_read_byte(addr) (*(const unsigned char *)(addr))
+#define memcpy_P memcpy
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+
+class String {
+public:
+	String(const char *cstr = "") : value(cstr) {}
+	String(const std::string &value) : value(value) {}
+
+	const char *c_str() const { return value.c_str(); }
+	unsigned int length() const { return value.length(); }
+	String operator+(const String &rhs) const { return String(value + rhs.value); }
+
+private:
+	std::string value;
+};
@@ -0,0 +1,66 @@
+// Host version of Arduino's Print and Stream interfaces
+#pragma once
+
+#include "Arduino.h"
+
+class Print {
+public:
+	virtual ~Print() {}
+
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t *buffer, size_t size) {
+		for (size_t i = 0; i < size; ++i) {
+			write(buffer[i]);
+		}
+		return size;
+	}
+	size_t write(const char *buffer, size_t size) {
+		return write((const uint8_t *) buffer, size);
+	}
+
+	size_t print(const char *str) { return write((const uint8_t *) str, strlen(str)); }
+	size_t print(const __FlashStringHelper *str) { return print((const char *) str); }
+	size_t print(char c) { return write((uint8_t) c); }
+	size_t print(const String &str) { return print(str.c_str()); }
+	size_t print(long value) {
+		char buffer[24];
+		snprintf(buffer, sizeof(buffer), "%ld", value);
+		return print(buffer);
+	}
+	size_t print(int value) { return print((long) value); }
+	size_t print(unsigned long value) {
+		char buffer[24];
+		snprintf(buffer, sizeof(buffer), "%lu", value);
+		return print(buffer);
+	}
+	size_t print(unsigned int value) { return print((unsigned long) value); }
+
+	template<typename T>
+	size_t println(const T &value) { return print(value) + print("\r\n"); }
+	size_t println() { return print("\r\n"); }
+};
+
+class Stream : public Print {
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+	virtual void flush() {}
+
+	void setTimeout(unsigned long timeout) { this->timeout = timeout; }
+
+	String readString() {
+		std::string value;
+		unsigned long begin = millis();
+		while (millis() - begin < timeout) {
+			if (available()) {
+				value += (char) read();
+				begin = millis();
+			}
+		}
+		return String(value);
+	}
+
+protected:
+	unsigned long timeout = 1000;
+};
@@ -0,0 +1,17 @@
+#include <chrono>
+#include <thread>
+#include "Arduino.h"
+
+static std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+unsigned long millis() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+unsigned long micros() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void delay(unsigned long ms) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
@@ -0,0 +1,696 @@
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include "emulator.h"
+#include "config.h"
+#include "constants.h"
+
+static std::vector<std::string> split(const std::string &value, char separator) {
+	std::vector<std::string> parts;
+	size_t begin = 0;
+	while (true) {
+		size_t end = value.find(separator, begin);
+		parts.push_back(value.substr(begin, end == std::string::npos ? std::string::npos : end - begin));
+		if (end == std::string::npos) {
+			return parts;
+		}
+		begin = end + 1;
+	}
+}
+
+static const char *status_text(int status) {
+	switch (status) {
+		case 200: return "OK";
+		case 401: return "Unauthorized";
+		case 403: return "Forbidden";
+		case 404: return "Not Found";
+		case 418: return "I'm a teapot";
+		case 500: return "Internal Server Error";
+		default: return "";
+	}
+}
+
+static void write_all(int fd, const std::string &data) {
+	size_t written = 0;
+	while (written < data.size()) {
+		ssize_t result = ::write(fd, data.data() + written, data.size() - written);
+		if (result <= 0) {
+			return;
+		}
+		written += result;
+	}
+}
+
+FirmwareEmulator::FirmwareEmulator(Stream &serial, const EmulatorOptions &options) :
+	serial(serial), options(options), split_opcode(FRAME_OP_UNKNOWN), framing(false), peer_max_payload(0), body_framing(false), connected(false),
+	baud_rate(options.baud_rate), previous_baud_rate(options.baud_rate), baud_check_deadline(0), listen_fd(-1), client_fd(-1), client_start_us(0), client_deadline(0), reply_started(false),
+	flow_control(false), credit(0), workers(0) {}
+
+FirmwareEmulator::~FirmwareEmulator() {
+	std::unique_lock<std::mutex> lock(workers_mutex);
+	workers_done.wait(lock, [this]() { return workers == 0; });
+
+	if (client_fd >= 0) {
+		close(client_fd);
+	}
+	if (listen_fd >= 0) {
+		close(listen_fd);
+	}
+}
+
+bool FirmwareEmulator::start() {
+	listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (listen_fd < 0) {
+		return false;
+	}
+
+	int reuse = 1;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(options.http_port);
+
+	return bind(listen_fd, (sockaddr *) &address, sizeof(address)) == 0 && listen(listen_fd, 16) == 0;
+}
+
+void FirmwareEmulator::poll() {
+	read_serial();
+	flush_tx();
+
+	if (baud_check_deadline && millis() > baud_check_deadline) {
+		// The sketch didn't get through at the new rate
+		baud_rate = previous_baud_rate;
+		options.switch_baud(baud_rate);
+		baud_check_deadline = 0;
+		rx.clear();
+	}
+
+	if (client_fd < 0) {
+		accept_client();
+	} else if (millis() > client_deadline) {
+		// The firmware answers with a 404 if the sketch doesn't, and cuts
+		// off a streamed reply that stalls
+		statistics.unanswered++;
+		if (reply_started) {
+			reply_started = false;
+			reply_head.clear();
+			close(client_fd);
+			client_fd = -1;
+		} else {
+			answer_client("status:404 ");
+		}
+	}
+}
+
+std::string FirmwareEmulator::encode(uint8_t opcode, const std::string &value) const {
+	if (framing) {
+		// Values longer than the sketch can take are split
+		size_t max_payload = peer_max_payload ? peer_max_payload : FRAME_MAX_PAYLOAD;
+		std::string frames;
+		size_t offset = 0;
+		do {
+			size_t length = std::min(value.size() - offset, max_payload);
+			bool more = offset + length < value.size();
+			uint8_t header[FRAME_HEADER_SIZE];
+			frame_write_header(header, offset ? FRAME_OP_CONTINUATION : opcode, length, more);
+			frames.append((const char *) header, FRAME_HEADER_SIZE);
+			frames.append(value, offset, length);
+			offset += length;
+		} while (offset < value.size());
+		return frames;
+	}
+
+	std::string line = frame_command_name(opcode);
+	if (!line.empty() && !value.empty()) {
+		line += " ";
+	}
+	line += value;
+	line += "\n";
+	return line;
+}
+
+void FirmwareEmulator::send(uint8_t opcode, const std::string &value) {
+	send_raw(encode(opcode, value));
+}
+
+void FirmwareEmulator::send_raw(const std::string &data) {
+	std::lock_guard<std::mutex> lock(send_mutex);
+	tx += data;
+}
+
+void FirmwareEmulator::flush_tx() {
+	std::lock_guard<std::mutex> lock(send_mutex);
+
+	size_t length = tx.size();
+	if (flow_control && length > credit) {
+		statistics.credit_stalls++;
+		length = credit;
+	}
+	if (!length) {
+		return;
+	}
+
+	serial.write((const uint8_t *) tx.data(), length);
+	tx.erase(0, length);
+	if (flow_control) {
+		credit -= length;
+	}
+}
+
+void FirmwareEmulator::read_serial() {
+	while (serial.available()) {
+		rx += (char) serial.read();
+	}
+
+	while (true) {
+		if (framing) {
+			if (rx.size() < FRAME_HEADER_SIZE) {
+				return;
+			}
+			uint16_t length = frame_read_length((const uint8_t *) rx.data());
+			if (rx.size() < size_t(FRAME_HEADER_SIZE + length)) {
+				return;
+			}
+
+			uint8_t opcode = rx[0];
+			bool more = frame_has_more((const uint8_t *) rx.data());
+			std::string payload = rx.substr(FRAME_HEADER_SIZE, length);
+			rx.erase(0, FRAME_HEADER_SIZE + length);
+
+			if (opcode == FRAME_OP_CONTINUATION) {
+				if (split_opcode == FRAME_OP_UNKNOWN) {
+					continue;
+				}
+				opcode = split_opcode;
+				payload = split_value + payload;
+			}
+			if (more) {
+				split_opcode = opcode;
+				split_value = payload;
+				continue;
+			}
+			split_opcode = FRAME_OP_UNKNOWN;
+			split_value.clear();
+			handle_message(opcode, payload);
+			continue;
+		}
+
+		size_t newline = rx.find('\n');
+		if (newline == std::string::npos) {
+			return;
+		}
+		std::string line = rx.substr(0, newline);
+
+		size_t space = line.find(' ');
+		std::string command = line.substr(0, space);
+		std::string value = space == std::string::npos ? "" : line.substr(space + 1);
+		uint8_t opcode = frame_opcode(command.data(), command.size());
+
+		if (opcode == FRAME_OP_REPLY_CHUNK) {
+			// The chunk's raw bytes follow its line
+			size_t length = strtoul(value.c_str(), nullptr, 10);
+			if (rx.size() < newline + 1 + length) {
+				return;
+			}
+			std::string chunk = rx.substr(newline + 1, length);
+			rx.erase(0, newline + 1 + length);
+			handle_message(opcode, chunk);
+			continue;
+		}
+		rx.erase(0, newline + 1);
+
+		// Anything that isn't a command is the answer to a waiting client
+		handle_message(opcode == FRAME_OP_UNKNOWN ? FRAME_OP_LINE : opcode, opcode == FRAME_OP_UNKNOWN ? line : value);
+	}
+}
+
+void FirmwareEmulator::handle_message(uint8_t opcode, const std::string &value) {
+	switch (opcode) {
+		case FRAME_OP_FRAMING:
+			if (options.binary_framing) {
+				peer_max_payload = atoi(value.c_str());
+				send(FRAME_OP_FRAMING, "1");
+				framing = true;
+			}
+			break;
+		case FRAME_OP_BODY_FRAMING:
+			if (options.body_framing) {
+				send(FRAME_OP_BODY_FRAMING, "1");
+				body_framing = true;
+			}
+			break;
+		case FRAME_OP_SSID:
+			ssid = value;
+			break;
+		case FRAME_OP_CONNECT:
+			connected = true;
+			break;
+		case FRAME_OP_DISCONNECT:
+			connected = false;
+			break;
+		case FRAME_OP_IS_CONNECTED:
+			send(FRAME_OP_IS_CONNECTED, connected ? "1" : "0");
+			break;
+		case FRAME_OP_GET_IP:
+			send(FRAME_OP_GET_IP, "127.0.0.1");
+			break;
+		case FRAME_OP_DEBUG:
+			send(FRAME_OP_LINE, "emulator ssid:" + ssid + (connected ? " connected" : " disconnected") + " baud:" + std::to_string(baud_rate));
+			send(FRAME_OP_LINE, "");
+			break;
+		case FRAME_OP_BAUD_RATE: {
+			unsigned long rate = strtoul(value.c_str(), nullptr, 10);
+			bool accept = rate && options.switch_baud && (!options.max_baud_rate || rate <= options.max_baud_rate);
+			send(FRAME_OP_BAUD_RATE, accept ? "1" : "0");
+			// The answer has to go out at the old rate
+			flush_tx();
+			if (accept) {
+				previous_baud_rate = baud_rate;
+				baud_rate = rate;
+				options.switch_baud(rate);
+				baud_check_deadline = millis() + 2 * BARF_BAUD_CHECK_TIMEOUT;
+				rx.clear();
+			}
+			break;
+		}
+		case FRAME_OP_FLOW_CONTROL:
+			if (options.flow_control) {
+				send(FRAME_OP_FLOW_CONTROL, "1");
+				flush_tx();
+				// Only what comes after the answer counts against the credit
+				std::lock_guard<std::mutex> lock(send_mutex);
+				flow_control = true;
+				credit = strtoul(value.c_str(), nullptr, 10);
+			}
+			break;
+		case FRAME_OP_CREDIT: {
+			std::lock_guard<std::mutex> lock(send_mutex);
+			credit += strtoul(value.c_str(), nullptr, 10);
+			break;
+		}
+		case FRAME_OP_BAUD_CHECK:
+			if (baud_check_deadline) {
+				send(FRAME_OP_BAUD_CHECK, value);
+			}
+			break;
+		case FRAME_OP_BAUD_CONFIRM:
+			baud_check_deadline = 0;
+			break;
+		case FRAME_OP_GET:
+		case FRAME_OP_POST:
+			fetch(opcode == FRAME_OP_POST, value);
+			break;
+		case FRAME_OP_ASYNC_GET:
+		case FRAME_OP_ASYNC_POST:
+			fetch_async(opcode == FRAME_OP_ASYNC_POST, value);
+			break;
+		case FRAME_OP_DATA:
+		case FRAME_OP_LINE:
+			if (client_fd >= 0 && !reply_started) {
+				answer_client(value);
+			}
+			break;
+		case FRAME_OP_REPLY_BEGIN:
+		case FRAME_OP_REPLY_HEADER:
+		case FRAME_OP_REPLY_CHUNK:
+		case FRAME_OP_REPLY_END:
+			if (client_fd >= 0) {
+				stream_reply(opcode, value);
+			}
+			break;
+		default:
+			// Settings the emulator has no use for
+			break;
+	}
+}
+
+void FirmwareEmulator::accept_client() {
+	client_fd = accept(listen_fd, nullptr, nullptr);
+	if (client_fd < 0) {
+		return;
+	}
+	client_start_us = micros();
+
+	timeval timeout = {1, 0};
+	setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	std::string head;
+	char buffer[512];
+	while (head.find("\r\n\r\n") == std::string::npos) {
+		ssize_t count = recv(client_fd, buffer, sizeof(buffer), 0);
+		if (count <= 0) {
+			close(client_fd);
+			client_fd = -1;
+			return;
+		}
+		head.append(buffer, count);
+	}
+
+	// "GET /path/to/thing?key=value HTTP/1.1"
+	std::vector<std::string> request_line = split(head.substr(0, head.find("\r\n")), ' ');
+	std::string target = request_line.size() > 1 ? request_line[1] : "/";
+	size_t question = target.find('?');
+	std::string path = target.substr(0, question);
+	std::string query = question == std::string::npos ? "" : target.substr(question + 1);
+
+	std::vector<std::string> fragments;
+	std::vector<std::string> parts = split(path, '/');
+	for (size_t i = 0; i < parts.size(); ++i) {
+		if (!parts[i].empty()) {
+			fragments.push_back(parts[i]);
+		}
+	}
+
+	// The body is whatever Content-Length says follows the head
+	size_t head_end = head.find("\r\n\r\n") + 4;
+	std::string body = head.substr(head_end);
+	size_t body_length = 0;
+	std::vector<std::string> lines = split(head.substr(0, head_end), '\n');
+	for (size_t i = 1; i < lines.size(); ++i) {
+		if (strncasecmp(lines[i].c_str(), "content-length:", 15) == 0) {
+			body_length = strtoul(lines[i].c_str() + 15, nullptr, 10);
+		}
+	}
+	while (body.size() < body_length) {
+		ssize_t count = recv(client_fd, buffer, sizeof(buffer), 0);
+		if (count <= 0) {
+			break;
+		}
+		body.append(buffer, count);
+	}
+	body.resize(body_length < body.size() ? body_length : body.size());
+
+	// Everything goes out in one piece, so a text mode body can't get
+	// mixed up with other messages
+	std::string message = encode(FRAME_OP_METHOD, request_line[0]);
+	message += encode(FRAME_OP_NUM_FRAMENTS, std::to_string(fragments.size()));
+	for (size_t i = 0; i < fragments.size(); ++i) {
+		message += encode(FRAME_OP_PATH_FRAGMENT, fragments[i]);
+	}
+	if (!query.empty()) {
+		std::vector<std::string> vars = split(query, '&');
+		for (size_t i = 0; i < vars.size(); ++i) {
+			size_t equals = vars[i].find('=');
+			message += encode(FRAME_OP_GET_VAR, vars[i].substr(0, equals));
+			message += encode(FRAME_OP_GET_VALUE, equals == std::string::npos ? "" : vars[i].substr(equals + 1));
+		}
+	}
+	if (!body.empty()) {
+		message += encode(FRAME_OP_BODY_LENGTH, std::to_string(body.size()));
+	}
+	message += encode(FRAME_OP_REQUEST_RESPONSE, "");
+
+	if (framing) {
+		size_t chunk = peer_max_payload ? peer_max_payload : 64;
+		for (size_t offset = 0; offset < body.size(); offset += chunk) {
+			message += encode(FRAME_OP_BODY, body.substr(offset, chunk));
+		}
+	} else {
+		message += body;
+	}
+	send_raw(message);
+
+	client_deadline = millis() + options.reply_timeout;
+}
+
+void FirmwareEmulator::answer_client(const std::string &reply) {
+	// Replies may start with "status:<code> "
+	int status = 200;
+	std::string body = reply;
+	if (body.compare(0, 7, "status:") == 0) {
+		status = atoi(body.c_str() + 7);
+		size_t space = body.find(' ');
+		body = space == std::string::npos ? "" : body.substr(space + 1);
+	}
+
+	std::string response = "HTTP/1.1 " + std::to_string(status) + " " + status_text(status) + "\r\n";
+	response += "Content-Type: text/html\r\n";
+	response += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+	response += "Connection: close\r\n\r\n";
+	response += body;
+	write_all(client_fd, response);
+	close_client();
+}
+
+void FirmwareEmulator::close_client() {
+	close(client_fd);
+	client_fd = -1;
+
+	unsigned long latency = micros() - client_start_us;
+	statistics.served++;
+	statistics.total_latency_us += latency;
+	if (latency > statistics.max_latency_us) {
+		statistics.max_latency_us = latency;
+	}
+}
+
+void FirmwareEmulator::stream_reply(uint8_t opcode, const std::string &value) {
+	// The head is held back until the first chunk, so headers can still be
+	// added to it
+	client_deadline = millis() + options.reply_timeout;
+
+	if (opcode == FRAME_OP_REPLY_BEGIN) {
+		int status = atoi(value.c_str());
+		reply_head = "HTTP/1.1 " + std::to_string(status) + " " + status_text(status) + "\r\n";
+		reply_started = true;
+		return;
+	}
+	if (!reply_started) {
+		return;
+	}
+	if (opcode == FRAME_OP_REPLY_HEADER) {
+		reply_head += value + "\r\n";
+		return;
+	}
+
+	if (!reply_head.empty()) {
+		write_all(client_fd, reply_head + "Transfer-Encoding: chunked\r\nConnection: close\r\n\r\n");
+		reply_head.clear();
+	}
+
+	if (opcode == FRAME_OP_REPLY_CHUNK) {
+		if (!value.empty()) {
+			char size[24];
+			snprintf(size, sizeof(size), "%zx\r\n", value.size());
+			write_all(client_fd, size + value + "\r\n");
+		}
+		return;
+	}
+
+	write_all(client_fd, "0\r\n\r\n");
+	reply_started = false;
+	close_client();
+}
+
+void FirmwareEmulator::fetch(bool post, const std::string &url) {
+	statistics.fetches++;
+	send_response(http_request(post, url), "");
+}
+
+void FirmwareEmulator::fetch_async(bool post, const std::string &value) {
+	// "<id> <url>", the response is tagged with the id
+	size_t space = value.find(' ');
+	if (space == std::string::npos) {
+		return;
+	}
+	std::string id = value.substr(0, space);
+	std::string url = value.substr(space + 1);
+
+	statistics.fetches++;
+	{
+		std::lock_guard<std::mutex> lock(workers_mutex);
+		workers++;
+	}
+
+	std::thread([this, post, id, url]() {
+		send_response(http_request(post, url), id);
+
+		std::lock_guard<std::mutex> lock(workers_mutex);
+		workers--;
+		workers_done.notify_all();
+	}).detach();
+}
+
+std::string FirmwareEmulator::http_request(bool post, const std::string &url) {
+	// host[:port][/path/to/resource]
+	size_t slash = url.find('/');
+	std::string host = url.substr(0, slash);
+	std::string path = slash == std::string::npos ? "/" : url.substr(slash);
+	std::string port = "80";
+	size_t colon = host.find(':');
+	if (colon != std::string::npos) {
+		port = host.substr(colon + 1);
+		host = host.substr(0, colon);
+	}
+
+	std::string response;
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo *address = nullptr;
+
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &address) == 0) {
+		int fd = socket(address->ai_family, address->ai_socktype, 0);
+		if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+			std::string request = std::string(post ? "POST " : "GET ") + path + " HTTP/1.0\r\n";
+			request += "Host: " + host + "\r\n";
+			if (post) {
+				request += "Content-Length: 0\r\n";
+			}
+			request += "\r\n";
+			write_all(fd, request);
+
+			char buffer[1024];
+			ssize_t count;
+			while ((count = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+				response.append(buffer, count);
+			}
+		}
+		if (fd >= 0) {
+			close(fd);
+		}
+		freeaddrinfo(address);
+	}
+	return response;
+}
+
+void FirmwareEmulator::send_response(const std::string &response, const std::string &id) {
+	size_t head_end = response.find("\r\n\r\n");
+	std::string head = response.substr(0, head_end);
+	std::string body = head_end == std::string::npos ? "" : response.substr(head_end + 4);
+
+	std::vector<std::string> headers;
+	std::vector<std::string> lines = split(head, '\n');
+	for (size_t i = 0; i < lines.size(); ++i) {
+		std::string header = lines[i];
+		if (!header.empty() && header[header.size() - 1] == '\r') {
+			header.erase(header.size() - 1);
+		}
+		if (!header.empty()) {
+			headers.push_back(header);
+		}
+	}
+
+	if (id.empty()) {
+		send_sync_response(headers, body);
+	} else {
+		send_async_response(headers, body, id);
+	}
+}
+
+static bool has_header(const std::vector<std::string> &headers, const char *name) {
+	for (size_t i = 0; i < headers.size(); ++i) {
+		if (strncasecmp(headers[i].c_str(), name, strlen(name)) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void FirmwareEmulator::send_sync_response(std::vector<std::string> headers, std::string body) {
+	// The head is passed on line by line, the body as it came so the
+	// library can find its end. Bodies delimited only by the connection
+	// closing get chunked encoding.
+	if (headers.empty()) {
+		headers.push_back("HTTP/1.0 502 Bad Gateway");
+	}
+	if (!body_framing) {
+		send_legacy_response(headers, body);
+		return;
+	}
+	if (!has_header(headers, "content-length:") && !has_header(headers, "transfer-encoding:")) {
+		headers.push_back("Transfer-Encoding: chunked");
+		std::string chunked;
+		for (size_t offset = 0; offset < body.size(); offset += 512) {
+			std::string chunk = body.substr(offset, 512);
+			char size[24];
+			snprintf(size, sizeof(size), "%zx\r\n", chunk.size());
+			chunked += size + chunk + "\r\n";
+		}
+		body = chunked + "0\r\n\r\n";
+	}
+
+	// Everything goes out in one piece, nothing else may get in between
+	// the raw bytes of a text mode body
+	std::string message = encode(FRAME_OP_RESPONSE_START, "");
+	for (size_t i = 0; i < headers.size(); ++i) {
+		message += encode(framing ? FRAME_OP_RESPONSE_HEADER : FRAME_OP_LINE, headers[i]);
+	}
+	message += encode(framing ? FRAME_OP_RESPONSE_HEADER : FRAME_OP_LINE, "");
+
+	if (framing) {
+		size_t chunk = peer_max_payload ? peer_max_payload : 64;
+		for (size_t offset = 0; offset < body.size(); offset += chunk) {
+			message += encode(FRAME_OP_RESPONSE_DATA, body.substr(offset, chunk));
+		}
+	} else {
+		message += body;
+	}
+	send_raw(message);
+}
+
+void FirmwareEmulator::send_legacy_response(const std::vector<std::string> &headers, const std::string &body) {
+	// As firmware before body_framing did: the body line by line, or in
+	// data frames, and response_end after it
+	std::string message = encode(FRAME_OP_RESPONSE_START, "");
+	for (size_t i = 0; i < headers.size(); ++i) {
+		message += encode(framing ? FRAME_OP_RESPONSE_HEADER : FRAME_OP_LINE, headers[i]);
+	}
+	message += encode(framing ? FRAME_OP_RESPONSE_HEADER : FRAME_OP_LINE, "");
+
+	if (framing) {
+		size_t chunk = peer_max_payload ? peer_max_payload : 64;
+		for (size_t offset = 0; offset < body.size(); offset += chunk) {
+			message += encode(FRAME_OP_RESPONSE_DATA, body.substr(offset, chunk));
+		}
+	} else {
+		std::vector<std::string> lines = split(body, '\n');
+		for (size_t i = 0; i < lines.size(); ++i) {
+			message += encode(FRAME_OP_LINE, lines[i]);
+		}
+	}
+	message += encode(FRAME_OP_RESPONSE_END, "");
+	send_raw(message);
+}
+
+void FirmwareEmulator::send_async_response(const std::vector<std::string> &headers, const std::string &body, const std::string &id) {
+	// Every message is prefixed with "<id> "
+	std::string tag = id + " ";
+
+	send(FRAME_OP_ASYNC_START, id);
+	for (size_t i = 0; i < headers.size(); ++i) {
+		send(framing ? FRAME_OP_ASYNC_HEADER : FRAME_OP_ASYNC_LINE, tag + headers[i]);
+	}
+
+	if (framing) {
+		size_t chunk = peer_max_payload ? peer_max_payload : 64;
+		if (chunk > tag.size()) {
+			chunk -= tag.size();
+		}
+		for (size_t offset = 0; offset < body.size(); offset += chunk) {
+			send(FRAME_OP_ASYNC_DATA, tag + body.substr(offset, chunk));
+		}
+	} else {
+		// The text protocol can only pass the body on line by line. The
+		// last line goes out even if it is empty, so the library knows
+		// whether the body ended in a newline.
+		send(FRAME_OP_ASYNC_LINE, tag);
+		std::vector<std::string> lines = split(body, '\n');
+		for (size_t i = 0; i < lines.size(); ++i) {
+			send(FRAME_OP_ASYNC_LINE, tag + lines[i]);
+		}
+	}
+
+	send(FRAME_OP_ASYNC_END, id);
+}
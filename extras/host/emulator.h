@@ -0,0 +1,120 @@
+// Emulates the barf ESP8266 firmware on a Linux host. Accepts real HTTP
+// requests on localhost and passes them to the sketch over the serial
+// protocol in constants.h, and answers get/post commands by making real
+// HTTP requests.
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Stream.h"
+
+struct EmulatorOptions {
+	EmulatorOptions() : http_port(8080), binary_framing(true), flow_control(true), body_framing(true), reply_timeout(2000), baud_rate(9600), max_baud_rate(0) {}
+
+	int http_port;
+	// Whether to accept binary framing when the library offers it
+	bool binary_framing;
+	// Whether to accept credit based flow control
+	bool flow_control;
+	// Whether to send get/post bodies by their length, or line by line up
+	// to response_end like older firmware
+	bool body_framing;
+	// How long to wait for the sketch to answer a request, in ms
+	unsigned long reply_timeout;
+	// Rate the link starts at, and the fastest one to agree to (0 for any)
+	unsigned long baud_rate;
+	unsigned long max_baud_rate;
+	// Switches the firmware's end of the link, baud rate changes are
+	// refused without it
+	std::function<void(unsigned long)> switch_baud;
+};
+
+struct EmulatorStats {
+	EmulatorStats() : served(0), unanswered(0), total_latency_us(0), max_latency_us(0), fetches(0), credit_stalls(0) {}
+
+	unsigned long served;
+	unsigned long unanswered;
+	unsigned long long total_latency_us;
+	unsigned long max_latency_us;
+	unsigned long fetches;
+	// How often output had to wait for credit
+	unsigned long credit_stalls;
+};
+
+class FirmwareEmulator {
+public:
+	FirmwareEmulator(Stream &serial, const EmulatorOptions &options);
+	~FirmwareEmulator();
+
+	// Opens the HTTP port, returns false if that fails
+	bool start();
+
+	// Does whatever work is pending without blocking for long
+	void poll();
+
+	EmulatorStats stats() const { return statistics; }
+
+private:
+	void read_serial();
+	void handle_message(uint8_t opcode, const std::string &value);
+	std::string encode(uint8_t opcode, const std::string &value) const;
+	void send(uint8_t opcode, const std::string &value);
+	void send_raw(const std::string &data);
+	void flush_tx();
+
+	void accept_client();
+	void answer_client(const std::string &reply);
+	void stream_reply(uint8_t opcode, const std::string &value);
+	void close_client();
+	void fetch(bool post, const std::string &url);
+	void fetch_async(bool post, const std::string &value);
+	std::string http_request(bool post, const std::string &url);
+	void send_response(const std::string &response, const std::string &id);
+	void send_sync_response(std::vector<std::string> headers, std::string body);
+	void send_legacy_response(const std::vector<std::string> &headers, const std::string &body);
+	void send_async_response(const std::vector<std::string> &headers, const std::string &body, const std::string &id);
+
+	Stream &serial;
+	EmulatorOptions options;
+	EmulatorStats statistics;
+
+	std::string rx;
+	// Frames of a value that goes on in CONTINUATION frames are joined here
+	uint8_t split_opcode;
+	std::string split_value;
+	bool framing;
+	size_t peer_max_payload;
+	bool body_framing;
+
+	bool connected;
+	std::string ssid;
+
+	unsigned long baud_rate;
+	unsigned long previous_baud_rate;
+	// When to fall back to previous_baud_rate if no check arrives, 0 if
+	// no switch is being checked
+	unsigned long baud_check_deadline;
+
+	int listen_fd;
+	int client_fd;
+	unsigned long client_start_us;
+	unsigned long client_deadline;
+	// Set between reply_begin and reply_end, reply_head is the part of
+	// the HTTP response that hasn't been written yet
+	bool reply_started;
+	std::string reply_head;
+
+	// Async requests are fetched on threads of their own, so messages are
+	// queued under a lock. poll() writes them out as far as the sketch's
+	// credit allows once it has asked for flow control.
+	std::mutex send_mutex;
+	std::string tx;
+	bool flow_control;
+	size_t credit;
+	std::mutex workers_mutex;
+	std::condition_variable workers_done;
+	int workers;
+};
@@ -0,0 +1,196 @@
+// Runs a barf sketch on the Linux host against the firmware emulator, with
+// both ends connected through an in-process serial link. Build from the
+// repository root with
+//
+//   g++ -std=gnu++11 -O2 -Iextras/host -I. -pthread
+//       *.cpp extras/host/arduino.cpp extras/host/pipe_stream.cpp
+//       extras/host/emulator.cpp extras/host/main.cpp -o barf_host
+//
+// (-DBARF_STATS=1 adds the library's counters to the summary printed on
+// exit) and try "curl localhost:8080/hello/world". /fetch/<host:port>/<page>
+// makes the sketch get() that resource through the emulator and stream it
+// back, /fanout/<host:port>/<page> gets it three times at once with
+// get_async(), /lines/<count> streams a reply of <count> lines and POST
+// /echo streams the request body back.
+//
+// Options: --port <http port>, --baud <serial baud rate to start at, 0 for
+// unpaced>, --max-baud <fastest rate the firmware agrees to>, --text to
+// refuse binary framing, --no-flow-control to refuse flow control,
+// --no-body-framing to send get/post bodies like older firmware.
+
+#include <signal.h>
+#include <atomic>
+#include <thread>
+#include <barf.h>
+#include "emulator.h"
+#include "pipe_stream.h"
+
+static std::atomic<bool> running(true);
+
+static void stop(int) {
+	running = false;
+}
+
+static void hello(Barf &barf, Request &request, const RouteParams &params) {
+	jString reply("hello ");
+	reply.append(params.get("name")->c_str(), params.get("name")->length());
+	barf.send_data(reply);
+}
+
+static void write_body(const char *data, uint32_t length, void *context) {
+	((ResponseWriter *) context)->write((const uint8_t *) data, length);
+}
+
+static void fetch(Barf &barf, Request &request, const RouteParams &params) {
+	jString url = *params.get("host");
+	for (uint32_t i = 2; i < request.fragments.size(); ++i) {
+		url.append("/", 1);
+		url.append(request.fragments[i].c_str(), request.fragments[i].length());
+	}
+
+	// The body is passed on as it arrives, it never has to fit in memory
+	ResponseWriter response(barf);
+	response.begin(200, "Content-Type: application/octet-stream");
+	if (!barf.get(url, write_body, &response)) {
+		response.print("\n(timed out)\n");
+	}
+	response.end();
+}
+
+static void lines(Barf &barf, Request &request, const RouteParams &params) {
+	ResponseWriter response(barf);
+	response.begin(200, "Content-Type: text/plain\r\nCache-Control: no-cache");
+	long count = 0;
+	parse_number(*params.get("count"), count);
+	for (long i = 0; i < count; ++i) {
+		response.print("line ");
+		response.println(i);
+	}
+	response.end();
+}
+
+static void append_body(const char *data, uint32_t length, void *context) {
+	((jString *) context)->append(data, length);
+}
+
+static void fanout(Barf &barf, Request &request, const RouteParams &params) {
+	jString url = *params.get("host");
+	url.append("/", 1);
+	url.append(params.get("page")->c_str(), params.get("page")->length());
+
+	jString bodies[3];
+	ResponseHandle handles[3];
+	for (int i = 0; i < 3; ++i) {
+		handles[i] = barf.get_async(url, append_body, &bodies[i]);
+	}
+
+	ResponseWriter response(barf);
+	for (int i = 0; i < 3; ++i) {
+		ResponseState state;
+		while ((state = barf.response_state(handles[i])) == RESPONSE_PENDING) {
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
+		if (state == RESPONSE_DONE) {
+			response.write((const uint8_t *) bodies[i].c_str(), bodies[i].length());
+		}
+	}
+	response.end();
+}
+
+static void echo(Barf &barf, Request &request, const RouteParams &params) {
+	// The body is passed back through a small buffer, whatever its size
+	ResponseWriter response(barf);
+	response.begin(200, "Content-Type: application/octet-stream");
+	char buffer[32];
+	uint32_t length;
+	while ((length = request.body.read(buffer, sizeof(buffer))) > 0) {
+		response.write((const uint8_t *) buffer, length);
+	}
+	response.end();
+}
+
+static void switch_link(unsigned long baud_rate, void *context) {
+	((SerialLink *) context)->set_baud_rate(baud_rate);
+}
+
+int main(int argc, char **argv) {
+	EmulatorOptions options;
+	unsigned long baud_rate = 9600;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--port" && i + 1 < argc) {
+			options.http_port = atoi(argv[++i]);
+		} else if (arg == "--baud" && i + 1 < argc) {
+			baud_rate = strtoul(argv[++i], nullptr, 10);
+		} else if (arg == "--max-baud" && i + 1 < argc) {
+			options.max_baud_rate = strtoul(argv[++i], nullptr, 10);
+		} else if (arg == "--text") {
+			options.binary_framing = false;
+		} else if (arg == "--no-flow-control") {
+			options.flow_control = false;
+		} else if (arg == "--no-body-framing") {
+			options.body_framing = false;
+		} else {
+			fprintf(stderr, "usage: %s [--port <port>] [--baud <rate>] [--max-baud <rate>] [--text] [--no-flow-control] [--no-body-framing]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	SerialLink link(baud_rate);
+	options.baud_rate = baud_rate;
+	options.switch_baud = [&link](unsigned long rate) { link.set_baud_rate(rate); };
+	FirmwareEmulator emulator(link.wifi_end, options);
+	if (!emulator.start()) {
+		perror("can't listen");
+		return 1;
+	}
+
+	signal(SIGINT, stop);
+	std::thread wifi([&emulator]() {
+		while (running) {
+			emulator.poll();
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
+	});
+
+	// The sketch
+	Barf barf(link.sketch_end, "ssid", "password", baud_rate, true);
+	barf.on("GET", "/hello/:name", hello);
+	barf.on("GET", "/fetch/:host/:page", fetch);
+	barf.on("GET", "/fanout/:host/:page", fanout);
+	barf.on("GET", "/lines/:count", lines);
+	barf.on("POST", "/echo", echo);
+	if (baud_rate) {
+		barf.set_baud_switch(switch_link, &link);
+	}
+	barf.init();
+	barf.connect();
+	while (!barf.is_connected()) {
+		delay(100);
+	}
+	printf("listening on localhost:%d, ip %s\n", options.http_port, barf.get_ip().c_str());
+	printf("%s\n", barf.debug_info().c_str());
+
+	while (running) {
+		Request request = barf.run();
+		if (!request.is_null()) {
+			printf("%s with %u fragments, not routed\n", request.method.c_str(), (unsigned) request.fragments.size());
+			barf.send_data("status:404 no route");
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+	wifi.join();
+
+	EmulatorStats stats = emulator.stats();
+	printf("served %lu, unanswered %lu, mean latency %llu us, max latency %lu us, fetches %lu, credit stalls %lu\n",
+		stats.served, stats.unanswered, stats.served ? stats.total_latency_us / stats.served : 0,
+		stats.max_latency_us, stats.fetches, stats.credit_stalls);
+#if BARF_STATS
+	const BarfStats &library = barf.stats();
+	printf("sketch: %lu requests, %lu dropped, %lu bytes in, %lu bytes out, %lu round trips, max %lu ms\n",
+		(unsigned long) library.requests, (unsigned long) library.requests_dropped, (unsigned long) library.bytes_in,
+		(unsigned long) library.bytes_out, (unsigned long) library.round_trips, (unsigned long) library.round_trip_max);
+#endif
+	return 0;
+}
@@ -0,0 +1,55 @@
+#include <algorithm>
+#include "pipe_stream.h"
+
+static bool arrives_before(const std::pair<uint8_t, unsigned long> &a, const std::pair<uint8_t, unsigned long> &b) {
+	return a.second < b.second;
+}
+
+SerialPipe::SerialPipe(unsigned long baud_rate) : baud_rate(baud_rate), line_free_at(0) {}
+
+void SerialPipe::set_baud_rate(unsigned long baud_rate) {
+	std::lock_guard<std::mutex> lock(mutex);
+	this->baud_rate = baud_rate;
+}
+
+void SerialPipe::write(uint8_t c) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	unsigned long now = micros();
+	if (line_free_at < now) {
+		line_free_at = now;
+	}
+	if (baud_rate) {
+		// Start bit, 8 data bits and a stop bit
+		line_free_at += 10 * 1000000UL / baud_rate;
+	}
+	bytes.push_back(std::make_pair(c, line_free_at));
+}
+
+int SerialPipe::available() {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// Arrival times only ever increase, so the arrived bytes are a prefix
+	std::pair<uint8_t, unsigned long> now(0xff, micros());
+	return std::upper_bound(bytes.begin(), bytes.end(), now, arrives_before) - bytes.begin();
+}
+
+int SerialPipe::read() {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (bytes.empty() || bytes.front().second > micros()) {
+		return -1;
+	}
+	uint8_t c = bytes.front().first;
+	bytes.pop_front();
+	return c;
+}
+
+int SerialPipe::peek() {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (bytes.empty() || bytes.front().second > micros()) {
+		return -1;
+	}
+	return bytes.front().first;
+}
@@ -0,0 +1,65 @@
+// In-process serial link between a sketch and the firmware emulator
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <utility>
+#include "Stream.h"
+
+// One direction of a serial line. A written byte only becomes readable
+// once it would have been shifted out at the configured baud rate.
+class SerialPipe {
+public:
+	explicit SerialPipe(unsigned long baud_rate);
+
+	// 0 disables pacing
+	void set_baud_rate(unsigned long baud_rate);
+
+	void write(uint8_t c);
+	int available();
+	int read();
+	int peek();
+
+private:
+	std::mutex mutex;
+	std::deque<std::pair<uint8_t, unsigned long> > bytes;
+	unsigned long baud_rate;
+	unsigned long line_free_at;
+};
+
+// Stream end point that reads from one pipe and writes to the other
+class PipeStream : public Stream {
+public:
+	PipeStream(SerialPipe &rx, SerialPipe &tx) : rx(rx), tx(tx) {}
+
+	int available() { return rx.available(); }
+	int read() { return rx.read(); }
+	int peek() { return rx.peek(); }
+
+	using Print::write;
+	size_t write(uint8_t c) {
+		tx.write(c);
+		return 1;
+	}
+
+private:
+	SerialPipe &rx;
+	SerialPipe &tx;
+};
+
+// Both directions of a link plus the stream for each end
+struct SerialLink {
+	explicit SerialLink(unsigned long baud_rate) :
+		to_wifi(baud_rate), to_sketch(baud_rate),
+		sketch_end(to_sketch, to_wifi), wifi_end(to_wifi, to_sketch) {}
+
+	void set_baud_rate(unsigned long baud_rate) {
+		to_wifi.set_baud_rate(baud_rate);
+		to_sketch.set_baud_rate(baud_rate);
+	}
+
+	SerialPipe to_wifi;
+	SerialPipe to_sketch;
+	PipeStream sketch_end;
+	PipeStream wifi_end;
+};
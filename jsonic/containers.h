@@ -1,10 +1,37 @@
 #pragma once
 
 #include <cstring>
+#include <stdint.h>
+#include <stdlib.h>
+// avr-gcc has no <new>, barf.h declares placement new there instead
+#ifndef __AVR__
+#include <new>
+#endif
+#ifdef __EXCEPTIONS
+#include <stdexcept>
+#endif
+
+// With USE_STL defined, Vector, String and HashMap are backed by the
+// standard library instead of the implementations below, keeping the
+// same interface
+#ifdef USE_STL
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#endif
 
 class TestVector;
 class TestBaseString;
 
+// All container memory is allocated through these, define them before
+// including this header to use a different allocator
+#ifndef JSONIC_MALLOC
+#define JSONIC_MALLOC malloc
+#define JSONIC_REALLOC realloc
+#define JSONIC_FREE free
+#endif
+
 namespace jsonic {
 
 namespace containers{
@@ -51,16 +78,98 @@ private:
 
 
 #ifdef USE_STL
+using std::move;
 using std::swap;
 #else
+template<typename _Tp> struct remove_reference { typedef _Tp type; };
+template<typename _Tp> struct remove_reference<_Tp&> { typedef _Tp type; };
+template<typename _Tp> struct remove_reference<_Tp&&> { typedef _Tp type; };
+
+template<typename _Tp>
+inline typename remove_reference<_Tp>::type&& move(_Tp&& __t) {
+    return static_cast<typename remove_reference<_Tp>::type&&>(__t);
+}
+
 template<typename _Tp>
 inline void swap(_Tp& __a, _Tp& __b) {
-    _Tp __tmp = __a;
-    __a = __b;
-    __b = __tmp;
+    _Tp __tmp = move(__a);
+    __a = move(__b);
+    __b = move(__tmp);
 }
 #endif
 
+#ifdef USE_STL
+
+template<typename T>
+using Vector = std::vector<T>;
+
+template<typename T>
+using BaseString = std::basic_string<T>;
+
+typedef std::string String;
+
+template <typename K>
+using KeyHash = std::hash<K>;
+
+// std::unordered_map with the jsonic HashMap interface on top
+template <typename K, typename V, typename F = KeyHash<K> >
+class HashMap : public std::unordered_map<K, V, F> {
+    typedef std::unordered_map<K, V, F> Base;
+
+public:
+    // Percentage of slots that may be in use before the table grows
+    void set_max_load_factor(uint8_t percent) {
+        Base::max_load_factor(percent / 100.0f);
+    }
+
+    // Pointer to the value for key, or nullptr if there is none
+    V* find_value(const K& key) const {
+        typename Base::const_iterator it = Base::find(key);
+        return it != Base::end() ? const_cast<V*>(&it->second) : nullptr;
+    }
+
+    V& operator[](const K& key) const {
+        return at(key);
+    }
+
+    V& at(const K& key) const {
+        return const_cast<V&>(Base::at(key));
+    }
+
+    void insert(const K& key, const V& value) {
+        Base::operator[](key) = value;
+    }
+};
+
+#else
+
+template<typename T> class Vector;
+template<typename T> class BaseString;
+
+// Types that can be moved to a new address with a plain memcpy, without
+// running a constructor and destructor. Anything that doesn't point into
+// itself qualifies, everything else has to be opted in here.
+template<typename T>
+struct is_trivially_relocatable { static const bool value = false; };
+
+template<typename T> struct is_trivially_relocatable<T*> { static const bool value = true; };
+template<> struct is_trivially_relocatable<bool> { static const bool value = true; };
+template<> struct is_trivially_relocatable<char> { static const bool value = true; };
+template<> struct is_trivially_relocatable<signed char> { static const bool value = true; };
+template<> struct is_trivially_relocatable<unsigned char> { static const bool value = true; };
+template<> struct is_trivially_relocatable<short> { static const bool value = true; };
+template<> struct is_trivially_relocatable<unsigned short> { static const bool value = true; };
+template<> struct is_trivially_relocatable<int> { static const bool value = true; };
+template<> struct is_trivially_relocatable<unsigned int> { static const bool value = true; };
+template<> struct is_trivially_relocatable<long> { static const bool value = true; };
+template<> struct is_trivially_relocatable<unsigned long> { static const bool value = true; };
+template<> struct is_trivially_relocatable<long long> { static const bool value = true; };
+template<> struct is_trivially_relocatable<unsigned long long> { static const bool value = true; };
+template<> struct is_trivially_relocatable<float> { static const bool value = true; };
+template<> struct is_trivially_relocatable<double> { static const bool value = true; };
+template<typename T> struct is_trivially_relocatable<Vector<T> > { static const bool value = true; };
+template<typename T> struct is_trivially_relocatable<BaseString<T> > { static const bool value = true; };
+
 template<typename T>
 class Vector {
     friend class ::TestVector;
@@ -76,7 +185,18 @@ public:
         }
     }
 
+    Vector(Vector&& rhs):
+        array_(rhs.array_), reserved_size_(rhs.reserved_size_), size_(rhs.size_) {
+        rhs.array_ = nullptr;
+        rhs.reserved_size_ = 0;
+        rhs.size_ = 0;
+    }
+
     Vector& operator=(const Vector& rhs) {
+        if(this == &rhs) {
+            return *this;
+        }
+
         clear();
         reserve(rhs.size());
 
@@ -87,6 +207,23 @@ public:
         return *this;
     }
 
+    Vector& operator=(Vector&& rhs) {
+        if(this == &rhs) {
+            return *this;
+        }
+
+        clear();
+        array_ = rhs.array_;
+        reserved_size_ = rhs.reserved_size_;
+        size_ = rhs.size_;
+
+        rhs.array_ = nullptr;
+        rhs.reserved_size_ = 0;
+        rhs.size_ = 0;
+
+        return *this;
+    }
+
     ~Vector() {
         clear();
     }
@@ -95,14 +232,7 @@ public:
     Iterator<Vector<T>, T> end() { return Iterator<Vector<T>, T>(); }
 
     void push_back(const T& thing) {
-        if(reserved_size_ == size_) {
-            //Double the reserved size
-            uint32_t new_size = reserved_size_ == 0 ? 1U : reserved_size_ * 2;
-
-            // Reserve the new reserved size (if this is the first time)
-            // this is equivalent to mallocing a single item
-            reallocate(new_size);
-        }
+        grow();
 
         // Initialize a new thing at the right place in the buffer
         new((void*)&array_[size_]) T(thing);
@@ -111,6 +241,13 @@ public:
         size_++;
     }
 
+    void push_back(T&& thing) {
+        grow();
+
+        new((void*)&array_[size_]) T(move(thing));
+        size_++;
+    }
+
     void pop_back() {
         array_[--size_].~T();
     }
@@ -128,7 +265,9 @@ public:
     }
 
     void reserve(uint32_t new_size) {
-        if(new_size < reserved_size_) {
+        // Nothing to do for what fits already, including copies of
+        // empty vectors
+        if(new_size <= reserved_size_) {
             return;
         }
 
@@ -141,7 +280,7 @@ public:
             pop_back();
         }
 
-        free((void*) array_);
+        JSONIC_FREE((void*) array_);
         array_ = nullptr;
         reserved_size_ = 0;
     }
@@ -155,13 +294,13 @@ public:
     }
 
     T& at(uint32_t index) const {
-#ifdef __EXCEPTIONS
         if(index >= size_) {
+#ifdef __EXCEPTIONS
             throw std::out_of_range("Tried to access beyond the vector");
-        }
 #else
-        abort();
+            abort();
 #endif
+        }
         return array_[index];
     }
 
@@ -170,35 +309,59 @@ public:
     bool empty() const { return size_ == 0; }
     uint32_t size() const { return size_; }
 private:
-    void reallocate(uint32_t new_size) {
-        // Allocate the new array
-        T* new_array = (T*) malloc(new_size * sizeof(T));
+    void grow() {
+        if(reserved_size_ == size_) {
+            //Double the reserved size
+            uint32_t new_size = reserved_size_ == 0 ? 1U : reserved_size_ * 2;
 
-        if(new_array) {
-            // Copy-construct the objects in the new buffer
-            // using placement new
-            for(uint32_t i = 0; i < size(); ++i) {
-                new(&new_array[i]) T(array_[i]);
+            // Reserve the new reserved size (if this is the first time)
+            // this is equivalent to mallocing a single item
+            reallocate(new_size);
+        }
+    }
 
-                // Destroy the old counterpart object
-                array_[i].~T();
+    void reallocate(uint32_t new_size) {
+        if(is_trivially_relocatable<T>::value) {
+            // The objects can just be moved bytewise, which realloc
+            // may even manage without copying anything
+            T* new_array = (T*) JSONIC_REALLOC((void*) array_, new_size * sizeof(T));
+
+            if(new_array) {
+                array_ = new_array;
+                reserved_size_ = new_size;
+                return;
             }
+        } else {
+            // Allocate the new array
+            T* new_array = (T*) JSONIC_MALLOC(new_size * sizeof(T));
 
-            // Swap the arrays
-            swap(array_, new_array);
+            if(new_array) {
+                // Move-construct the objects in the new buffer
+                // using placement new
+                for(uint32_t i = 0; i < size(); ++i) {
+                    new(&new_array[i]) T(move(array_[i]));
 
-            // Free the original array
-            free((void*) new_array);
+                    // Destroy the old counterpart object
+                    array_[i].~T();
+                }
+
+                // Swap the arrays
+                swap(array_, new_array);
+
+                // Free the original array
+                JSONIC_FREE((void*) new_array);
+
+                // Update the reserved size
+                reserved_size_ = new_size;
+                return;
+            }
+        }
 
-            // Update the reserved size
-            reserved_size_ = new_size;
-        } else {
 #ifdef __EXCEPTIONS
-            throw std::bad_alloc();
+        throw std::bad_alloc();
 #else
-            abort();
+        abort();
 #endif
-        }
     }
 
     T* array_ = nullptr;
@@ -213,30 +376,42 @@ class BaseString {
 public:
     static const uint32_t npos = -1;
 
+    // Strings up to this length are stored inside the object itself,
+    // longer ones spill over onto the heap
+    static const uint32_t INLINE_CAPACITY = 16 / sizeof(T) - 1;
+
     BaseString() {
-        data_.push_back('\0');
+        inline_[0] = '\0';
     }
 
     BaseString(const BaseString& rhs) {
-        data_ = rhs.data_;
+        inline_[0] = '\0';
+        assign(rhs.c_str(), rhs.length());
+    }
+
+    // Leaves rhs as an empty string
+    BaseString(BaseString&& rhs) {
+        take(rhs);
     }
 
     BaseString(const T* cstr) {
-        data_.push_back('\0');
+        inline_[0] = '\0';
 
-        const T* ch = cstr;
-        while(*ch != '\0') {
-            push_back(*ch);
-            ++ch;
+        uint32_t len = 0;
+        while(cstr[len] != '\0') {
+            ++len;
         }
+        assign(cstr, len);
     }
+
     BaseString(const T* cstr, uint32_t len) {
-        data_.push_back('\0');
+        inline_[0] = '\0';
+        assign(cstr, len);
+    }
 
-        const T* ch = cstr;
-        for(uint32_t i = 0; i < len; i++) {
-            push_back(*ch);
-            ++ch;
+    ~BaseString() {
+        if(on_heap_) {
+            JSONIC_FREE((void*) heap_.data);
         }
     }
 
@@ -245,60 +420,45 @@ public:
     Iterator<BaseString<T>, T> begin() { return Iterator<BaseString<T>, T>(this); }
     Iterator<BaseString<T>, T> end() { return Iterator<BaseString<T>, T>(); }
 
-    uint32_t find(const BaseString& string, uint32_t pos=0) {
-        if(string.empty()) return BaseString::npos;
-
-        char firstc = string[0];
-        bool matching = false;
-        uint32_t j = 0;
-        for(uint32_t i = pos; i < size(); ++i) {
-            if(matching) {
-                if(j == string.size()) {
-                    // If we were matching and we just hit the last character
-                    // then we return the offset to the first c
-                    return i - j;
-                } else if(data_[i] != string[j]) {
-                    // Not a match
-                    matching = false;
+    uint32_t find(const BaseString& string, uint32_t pos=0) const {
+        if(string.empty() || string.size() > size()) return BaseString::npos;
+
+        // Look for the first character, with memchr for plain chars, and
+        // only compare the rest where it matches
+        const T* data = c_str();
+        const T first = string.c_str()[0];
+        uint32_t last = size() - string.size();
+        for(uint32_t i = pos; i <= last; ++i) {
+            if(sizeof(T) == 1) {
+                const T* found = (const T*) memchr(data + i, first, last - i + 1);
+                if(!found) {
+                    break;
                 }
-                ++j;
+                i = found - data;
+            } else if(data[i] != first) {
+                continue;
             }
 
-            if(!matching && data_[i] == firstc) {
-                // Start searching
-                matching = true;
-                j = 1;
+            if(memcmp(data + i + 1, string.c_str() + 1, (string.size() - 1) * sizeof(T)) == 0) {
+                return i;
             }
         }
         return BaseString::npos;
     }
 
     BaseString& erase(uint32_t pos = 0, uint32_t len=BaseString::npos) {
-        uint32_t erase_length = (len == BaseString::npos) ? size() - pos: len;
-
-        if(erase_length == 0) {
+        if(pos >= size()) {
             return *this;
         }
 
-        uint32_t max = (pos + erase_length) > length() ? length() : pos + erase_length;
-
-        // Go from the start position, until we hit the erase length
-        for(uint32_t i = pos; i < max; ++i) {
-            // If there characters after the portion we're erasing
-            // we shift them down, otherwise we just replace the character
-            // with a null char.
-            uint32_t replacement_idx = i + erase_length;
-            T replacement = '\0';
-            if(replacement_idx < size()) {
-                replacement = data_.at(replacement_idx);
-            }
-            data_[i] = replacement;
+        if(len == BaseString::npos || len > size() - pos) {
+            len = size() - pos;
         }
 
-        // Finally once we've shifted the entire string down by erase_length
-        // we truncate the data
-        data_.resize(data_.size() - erase_length);
-        data_[data_.size() - 1] = '\0';
+        // Shift everything after the erased part down, including the null
+        T* data = buffer();
+        memmove(data + pos, data + pos + len, (size_ - pos - len + 1) * sizeof(T));
+        size_ -= len;
 
         return *this;
     }
@@ -309,51 +469,126 @@ public:
     }
 
     BaseString& operator=(const BaseString& rhs) {
-        data_.resize(1, '\0');
-        for(uint32_t i = 0; i < rhs.size(); ++i) {
-            push_back(rhs[i]);
+        if(this == &rhs) {
+            return *this;
+        }
+
+        assign(rhs.c_str(), rhs.length());
+        return *this;
+    }
+
+    BaseString& operator=(BaseString&& rhs) {
+        if(this == &rhs) {
+            return *this;
         }
+
+        if(on_heap_) {
+            JSONIC_FREE((void*) heap_.data);
+        }
+        take(rhs);
         return *this;
     }
 
-    BaseString substr(uint32_t pos, uint32_t len) {
-        T sub[len+1];
-        memcpy(sub, c_str() + pos, sizeof(T) * (len + 1));
-        return BaseString<T>(sub, len);
+    BaseString substr(uint32_t pos, uint32_t len) const {
+        if(pos > size()) {
+            pos = size();
+        }
+        if(len > size() - pos) {
+            len = size() - pos;
+        }
+        return BaseString<T>(c_str() + pos, len);
     }
 
-    BaseString substr(uint32_t pos = 0) {
-        uint32_t len = length() - pos;
-        return substr(pos, len);
+    BaseString substr(uint32_t pos = 0) const {
+        return substr(pos, BaseString::npos);
     }
 
     BaseString& insert(uint32_t pos, const BaseString& string) {
         if(string.empty()) return *this;
 
-        // Make room, plus the null character
-        data_.resize(length() + string.length() + 1);
+        if(pos > size()) {
+            pos = size();
+        }
+
+        if(&string == this) {
+            // The copy stays put while this string grows
+            BaseString copy(string);
+            return insert(pos, copy);
+        }
+
+        uint32_t len = string.length();
+        reserve(size_ + len);
+
+        // Make room at the insertion point, then copy the string in
+        T* data = buffer();
+        memmove(data + pos + len, data + pos, (size_ - pos + 1) * sizeof(T));
+        memcpy(data + pos, string.c_str(), len * sizeof(T));
+        size_ += len;
+
+        return *this;
+    }
+
+    BaseString& append(const T* str, uint32_t len) {
+        // str may point into this string, whose buffer reserve() can move
+        const T* old_data = c_str();
+        bool aliased = str >= old_data && str <= old_data + size_;
+        uint32_t offset = aliased ? str - old_data : 0;
 
-        // Shift everything up to the insertion point to the end
-        for(int64_t i = (int) data_.size() - 2; i >= pos; --i) {
-            if(i - int(string.length()) >= 0) {
-                data_[i] = data_[i - string.length()];
+        reserve(size_ + len);
+
+        T* data = buffer();
+        if(aliased) {
+            str = data + offset;
+        }
+        memcpy(data + size_, str, len * sizeof(T));
+        size_ += len;
+        data[size_] = '\0';
+
+        return *this;
+    }
+
+    void reserve(uint32_t new_capacity) {
+        if(new_capacity <= capacity()) {
+            return;
+        }
+
+        // Grow at least geometrically so that appending stays linear
+        if(new_capacity < capacity() * 2) {
+            new_capacity = capacity() * 2;
+        }
+
+        T* data;
+        if(on_heap_) {
+            data = (T*) JSONIC_REALLOC((void*) heap_.data, (new_capacity + 1) * sizeof(T));
+        } else {
+            data = (T*) JSONIC_MALLOC((new_capacity + 1) * sizeof(T));
+            if(data) {
+                memcpy(data, inline_, (size_ + 1) * sizeof(T));
             }
         }
 
-        // Now copy the string to the insertion point
-        for(uint32_t i = 0; i < string.length(); ++i) {
-            data_[i + pos] = string[i];
+        if(!data) {
+#ifdef __EXCEPTIONS
+            throw std::bad_alloc();
+#else
+            abort();
+#endif
         }
 
-        data_[data_.size() - 1] = '\0';
+        heap_.data = data;
+        heap_.capacity = new_capacity;
+        on_heap_ = true;
+    }
 
-        return *this;
+    uint32_t capacity() const {
+        return on_heap_ ? heap_.capacity : INLINE_CAPACITY;
     }
 
     bool operator==(const T* rhs) const {
+        const T* data = c_str();
         uint32_t i = 0;
         while(*rhs) {
-            if(i >= length() || data_[i] != *rhs) {
+            if(i >= length() || data[i] != *rhs) {
                 return false;
             }
 
@@ -369,12 +604,7 @@ public:
             return false;
         }
 
-        for(uint32_t i = 0; i < length(); ++i) {
-            if(data_[i] != rhs.data_[i]) {
-                return false;
-            }
-        }
-        return true;
+        return memcmp(c_str(), rhs.c_str(), length() * sizeof(T)) == 0;
     }
 
     bool operator!=(const T *rhs) const {
@@ -385,29 +615,68 @@ public:
         return !(*this == rhs);
     }
 
-    BaseString operator+(const BaseString & rhs) {
-        BaseString<T> result = *this;
-        return result.insert(length(), rhs);
+    BaseString operator+(const BaseString & rhs) const {
+        BaseString<T> result;
+        result.reserve(length() + rhs.length());
+        result.append(c_str(), length());
+        result.append(rhs.c_str(), rhs.length());
+        return result;
     }
 
     T operator[](const uint32_t idx) const {
-        return data_[idx];
+        return c_str()[idx];
     }
 
     const T* c_str() const {
-        return &data_[0];
+        return on_heap_ ? heap_.data : inline_;
     }
 
     void push_back(T c) {
-        data_[data_.size() - 1] = c;
-        data_.push_back('\0');
+        reserve(size_ + 1);
+
+        T* data = buffer();
+        data[size_++] = c;
+        data[size_] = '\0';
     }
 
-    uint32_t size() const { return data_.size() - 1; }
-    uint32_t length() const { return data_.size() - 1; }
+    uint32_t size() const { return size_; }
+    uint32_t length() const { return size_; }
 
 private:
-    Vector<T> data_;
+    T* buffer() {
+        return on_heap_ ? heap_.data : inline_;
+    }
+
+    void assign(const T* str, uint32_t len) {
+        size_ = 0;
+        append(str, len);
+    }
+
+    void take(BaseString& rhs) {
+        if(rhs.on_heap_) {
+            heap_ = rhs.heap_;
+        } else {
+            memcpy(inline_, rhs.inline_, (rhs.size_ + 1) * sizeof(T));
+        }
+        size_ = rhs.size_;
+        on_heap_ = rhs.on_heap_;
+
+        rhs.inline_[0] = '\0';
+        rhs.size_ = 0;
+        rhs.on_heap_ = false;
+    }
+
+    struct HeapStorage {
+        T* data;
+        uint32_t capacity;
+    };
+
+    union {
+        T inline_[INLINE_CAPACITY + 1];
+        HeapStorage heap_;
+    };
+    uint32_t size_ = 0;
+    bool on_heap_ = false;
 };
 
 template<typename T>
@@ -426,38 +695,41 @@ typedef BaseString<char> String;
 template <typename K, typename V>
 struct HashNode {
 public:
+    HashNode(const K& key, const V& value):
+        first(key), second(value) {}
+
+    HashNode(HashNode&& rhs):
+        first(move(rhs.first)), second(move(rhs.second)) {}
+
+    HashNode& operator=(HashNode&& rhs) {
+        first = move(rhs.first);
+        second = move(rhs.second);
+        return *this;
+    }
+
     // key-value pair
     K first;
     V second;
-
-    // next bucket with the same key
-    HashNode *next = nullptr;
 };
 
-const int TABLE_SIZE = 10;
-
 // Default hash function class
 template <typename K>
 struct KeyHash {
     unsigned long operator()(const K& key) const
     {
-        return reinterpret_cast<unsigned long>(key) % TABLE_SIZE;
+        return (unsigned long) key;
     }
 };
 
 template<>
 struct KeyHash<String> {
     unsigned long operator()(const String& key) const {
-        int hash = 0;
+        // FNV-1a
+        uint32_t hash = 2166136261UL;
 
         for(unsigned int i = 0; i<key.length();  i++) {
-            hash = 37 * hash + key[i];
-        }
-
-        hash %= TABLE_SIZE;
-
-        if(hash < 0) {
-             hash += TABLE_SIZE;
+            hash ^= (unsigned char) key[i];
+            hash *= 16777619UL;
         }
 
         return hash;
@@ -472,63 +744,112 @@ struct HashMapIterator {
     HashMapIterator(){} // Represents 'end'
 
     HashMapIterator(HashMap<K, V, F>* owner):
-        owner_(owner) {
-
+        owner_(owner), index_(0) {
+        skip_empty();
     }
 
-    // Stuff to implement!
-    void operator++() {}
-    HashNode<K, V>& operator->() const {
+    void operator++() {
+        ++index_;
+        skip_empty();
+    }
 
+    HashNode<K, V>* operator->() const {
+        return &owner_->entries_[index_];
     }
+
     HashNode<K, V>& operator*() const {
+        return owner_->entries_[index_];
+    }
+
+    bool operator==(const HashMapIterator& rhs) const {
+        return owner_ == rhs.owner_ && index_ == rhs.index_;
+    }
+
+    bool operator!=(const HashMapIterator& rhs) const {
+        return !(*this == rhs);
+    }
+
+private:
+    void skip_empty() {
+        while(owner_ && index_ < owner_->capacity_ && !owner_->distances_[index_]) {
+            ++index_;
+        }
 
+        // Past the last entry, so make it the same as 'end'
+        if(owner_ && index_ == owner_->capacity_) {
+            owner_ = nullptr;
+            index_ = 0;
+        }
     }
-    bool operator==(const HashMapIterator& rhs) const {}
-    bool operator!=(const HashMapIterator) const {}
 
     HashMap<K, V, F>* owner_ = nullptr;
+    uint32_t index_ = 0;
 };
 
 
-// Hash map class template
+// Open addressing hash map using Robin Hood probing: an entry that is
+// further from its home slot than the one occupying a slot takes it over,
+// which keeps probe sequences short. Erasing shifts the following entries
+// back instead of leaving tombstones. The table grows by doubling once it
+// is fuller than the max load factor.
 template <typename K, typename V, typename F = KeyHash<K> >
 class HashMap {
+    friend struct HashMapIterator<K, V, F>;
+
 public:
-    HashMap() {
-        // construct zero initialized hash table of size
-        table_.resize(TABLE_SIZE, nullptr);
+    static const uint32_t MIN_CAPACITY = 8;
+
+    HashMap() {}
+
+    HashMap(const HashMap& rhs):
+        max_load_percent_(rhs.max_load_percent_) {
+        copy_from(rhs);
     }
 
-    ~HashMap() {
-        // destroy all buckets one by one
-        for (int i = 0; i < table_.size(); ++i) {
-            HashNode<K, V> *entry = table_.at(i);
-            while (entry) {
-                HashNode<K, V> *prev = entry;
-                entry = entry->next;
-                delete prev;
-            }
-            table_[i] = nullptr;
+    HashMap(HashMap&& rhs) {
+        take(rhs);
+    }
+
+    HashMap& operator=(const HashMap& rhs) {
+        if(this != &rhs) {
+            release();
+            max_load_percent_ = rhs.max_load_percent_;
+            copy_from(rhs);
+        }
+        return *this;
+    }
+
+    HashMap& operator=(HashMap&& rhs) {
+        if(this != &rhs) {
+            release();
+            take(rhs);
         }
-        // destroy the hash table
-        table_.clear();
+        return *this;
+    }
+
+    ~HashMap() {
+        release();
     }
 
     HashMapIterator<K, V, F> begin() { return HashMapIterator<K, V, F>(this); }
     HashMapIterator<K, V, F> end() { return HashMapIterator<K, V, F>(); }
 
+    uint32_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // Percentage of slots that may be in use before the table grows
+    void set_max_load_factor(uint8_t percent) {
+        max_load_percent_ = percent < 10 ? 10 : (percent > 95 ? 95 : percent);
+    }
+
     uint32_t count(const K& key) const {
-        unsigned long hash = hash_func_(key);
-        HashNode<K, V>* entry = table_[hash];
+        return find_index(key) != NOT_FOUND ? 1 : 0;
+    }
 
-        while (entry) {
-            if (entry->first == key) {
-                return 1;
-            }
-            entry = entry->next;
-        }
-        return 0;
+    // Pointer to the value for key, or nullptr if there is none
+    V* find_value(const K& key) const {
+        uint32_t index = find_index(key);
+        return index != NOT_FOUND ? &entries_[index].second : nullptr;
     }
 
     V& operator[](const K& key) const {
@@ -536,90 +857,218 @@ public:
     }
 
     V& at(const K &key) const {
-        unsigned long hash = hash_func_(key);
-        HashNode<K, V>* entry = table_[hash];
-
-        while (entry) {
-            if (entry->first == key) {
-                return entry->second;
-            }
-            entry = entry->next;
-        }
+        V* value = find_value(key);
 
+        if(!value) {
 #ifdef __EXCEPTIONS
-        throw std::out_of_range("No such key exists");
+            throw std::out_of_range("No such key exists");
 #else
-        abort();
+            abort();
 #endif
+        }
+        return *value;
     }
 
     void insert(const K &key, const V &value) {
-        unsigned long hash = hash_func_(key);
-        HashNode<K, V>* prev = nullptr;
-        HashNode<K, V>* entry = table_[hash];
-
-        while (entry && entry->first != key) {
-            prev = entry;
-            entry = entry->second;
-        }
-
-        if (!entry) {
-            entry = new HashNode<K, V>(key, value);
-            if (!prev) {
-                // insert as first bucket
-                table_[hash] = entry;
-            } else {
-                prev->next = entry;
-            }
-        } else {
+        V* existing = find_value(key);
+        if(existing) {
             // just update the value
-            entry->second = value;
+            *existing = value;
+            return;
         }
+
+        if((size_ + 1) * 100 > capacity_ * max_load_percent_) {
+            rehash(capacity_ ? capacity_ * 2 : MIN_CAPACITY);
+        }
+
+        insert_node(HashNode<K, V>(key, value));
     }
 
     void erase(const K &key) {
-        unsigned long hash = hash_func_(key);
-        HashNode<K, V> *prev = nullptr;
-        HashNode<K, V> *entry = table_[hash];
+        uint32_t index = find_index(key);
+        if(index == NOT_FOUND) {
+            // key not found
+            return;
+        }
+
+        entries_[index].~HashNode<K, V>();
+        distances_[index] = 0;
+        size_--;
 
-        while (entry && entry->first != key) {
-            prev = entry;
-            entry = entry->next;
+        // Shift the following entries of the probe sequence back by one
+        uint32_t next = (index + 1) & (capacity_ - 1);
+        while(distances_[next] > 1) {
+            new(&entries_[index]) HashNode<K, V>(move(entries_[next]));
+            entries_[next].~HashNode<K, V>();
+            distances_[index] = distances_[next] - 1;
+            distances_[next] = 0;
+
+            index = next;
+            next = (next + 1) & (capacity_ - 1);
         }
+    }
 
-        if (!entry) {
-            // key not found
-            return;
+    void clear() {
+        release();
+    }
+
+private:
+    static const uint32_t NOT_FOUND = -1;
+
+    uint32_t home(const K& key) const {
+        // Fibonacci hashing spreads weak hashes over the whole table
+        return uint32_t(uint32_t(hash_func_(key)) * 2654435769UL) >> (32 - capacity_bits_);
+    }
+
+    uint32_t find_index(const K& key) const {
+        if(!size_) {
+            return NOT_FOUND;
         }
-        else {
-            if (!prev) {
-                // remove first bucket of the list
-                table_[hash] = entry->next;
-            } else {
-                prev->next = entry->next;
+
+        uint32_t index = home(key);
+        uint8_t distance = 1;
+
+        // An entry closer to its home than we are to ours means the key
+        // would have displaced it, so it can't be further on
+        while(distances_[index] >= distance) {
+            if(distances_[index] == distance && entries_[index].first == key) {
+                return index;
             }
-            delete entry;
+
+            index = (index + 1) & (capacity_ - 1);
+            distance++;
         }
+        return NOT_FOUND;
     }
 
-    void clear() {
-        for(uint32_t i = 0; i < table_.size(); ++i) {
-            HashNode<K, V> *node = table_[i];
-            while(node) {
-                HashNode<K, V>* to_delete = node;
-                node = node->next;
-                delete to_delete;
+    void insert_node(HashNode<K, V>&& moved) {
+        HashNode<K, V> node(move(moved));
+        uint32_t index = home(node.first);
+        uint8_t distance = 1;
+
+        while(distances_[index]) {
+            if(distances_[index] < distance) {
+                // Take the slot over from an entry closer to its home
+                swap(node, entries_[index]);
+                swap(distance, distances_[index]);
+            }
+
+            index = (index + 1) & (capacity_ - 1);
+            distance++;
+
+            if(distance == 0xff) {
+                // Pathologically long probe sequence, grow and start over
+                rehash(capacity_ * 2);
+                insert_node(move(node));
+                return;
             }
         }
-        table_.clear();
+
+        new(&entries_[index]) HashNode<K, V>(move(node));
+        distances_[index] = distance;
+        size_++;
     }
 
-private:
-    // hash table
-    Vector<HashNode<K, V>*> table_;
+    void rehash(uint32_t new_capacity) {
+        HashNode<K, V>* old_entries = entries_;
+        uint8_t* old_distances = distances_;
+        uint32_t old_capacity = capacity_;
+
+        allocate(new_capacity);
+
+        for(uint32_t i = 0; i < old_capacity; ++i) {
+            if(old_distances[i]) {
+                insert_node(move(old_entries[i]));
+                old_entries[i].~HashNode<K, V>();
+            }
+        }
+
+        JSONIC_FREE((void*) old_entries);
+        JSONIC_FREE((void*) old_distances);
+    }
+
+    void allocate(uint32_t new_capacity) {
+        entries_ = (HashNode<K, V>*) JSONIC_MALLOC(new_capacity * sizeof(HashNode<K, V>));
+        distances_ = (uint8_t*) JSONIC_MALLOC(new_capacity);
+
+        if(!entries_ || !distances_) {
+#ifdef __EXCEPTIONS
+            throw std::bad_alloc();
+#else
+            abort();
+#endif
+        }
+
+        memset(distances_, 0, new_capacity);
+        capacity_ = new_capacity;
+        capacity_bits_ = 0;
+        while((1UL << capacity_bits_) < new_capacity) {
+            capacity_bits_++;
+        }
+        size_ = 0;
+    }
+
+    void release() {
+        for(uint32_t i = 0; i < capacity_; ++i) {
+            if(distances_[i]) {
+                entries_[i].~HashNode<K, V>();
+            }
+        }
+
+        JSONIC_FREE((void*) entries_);
+        JSONIC_FREE((void*) distances_);
+        entries_ = nullptr;
+        distances_ = nullptr;
+        capacity_ = 0;
+        capacity_bits_ = 0;
+        size_ = 0;
+    }
+
+    void copy_from(const HashMap& rhs) {
+        if(!rhs.capacity_) {
+            return;
+        }
+
+        allocate(rhs.capacity_);
+        for(uint32_t i = 0; i < rhs.capacity_; ++i) {
+            if(rhs.distances_[i]) {
+                new(&entries_[i]) HashNode<K, V>(rhs.entries_[i].first, rhs.entries_[i].second);
+                distances_[i] = rhs.distances_[i];
+            }
+        }
+        size_ = rhs.size_;
+    }
+
+    void take(HashMap& rhs) {
+        entries_ = rhs.entries_;
+        distances_ = rhs.distances_;
+        capacity_ = rhs.capacity_;
+        capacity_bits_ = rhs.capacity_bits_;
+        size_ = rhs.size_;
+        max_load_percent_ = rhs.max_load_percent_;
+
+        rhs.entries_ = nullptr;
+        rhs.distances_ = nullptr;
+        rhs.capacity_ = 0;
+        rhs.capacity_bits_ = 0;
+        rhs.size_ = 0;
+    }
+
+    HashNode<K, V>* entries_ = nullptr;
+    // Probe distance + 1 of the entry in each slot, 0 for empty slots
+    uint8_t* distances_ = nullptr;
+    uint32_t capacity_ = 0;
+    uint8_t capacity_bits_ = 0;
+    uint32_t size_ = 0;
+    uint8_t max_load_percent_ = 80;
     F hash_func_;
 };
 
+template<typename K, typename V, typename F>
+struct is_trivially_relocatable<HashMap<K, V, F> > { static const bool value = true; };
+
+#endif
+
 }
 
 
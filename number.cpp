@@ -0,0 +1,155 @@
+#include <limits.h>
+#include "number.h"
+
+static const unsigned long POWERS_OF_TEN[NUMBER_MAX_DECIMALS + 1] = {
+	1UL, 10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL, 10000000UL, 100000000UL, 1000000000UL
+};
+
+static uint8_t format_digits(char *buffer, uint8_t size, unsigned long value, uint8_t min_digits) {
+	// At least min_digits digits, padded with zeros in front
+	char digits[NUMBER_TEXT_MAX];
+	uint8_t count = 0;
+	if (value <= 0xffff) {
+		// 16 bit division is several times faster on 8 bit boards, and
+		// most numbers we send are small
+		uint16_t small = value;
+		do {
+			digits[count++] = '0' + small % 10;
+			small /= 10;
+		} while (small || count < min_digits);
+	} else {
+		do {
+			digits[count++] = '0' + value % 10;
+			value /= 10;
+		} while (value || count < min_digits);
+	}
+
+	if (count > size) {
+		return 0;
+	}
+	for (uint8_t i = 0; i < count; ++i) {
+		buffer[i] = digits[count - 1 - i];
+	}
+	return count;
+}
+
+uint8_t format_number(char *buffer, uint8_t size, unsigned long value) {
+	return format_digits(buffer, size, value, 1);
+}
+
+uint8_t format_number(char *buffer, uint8_t size, long value) {
+	return format_fixed(buffer, size, value, 0);
+}
+
+uint8_t format_fixed(char *buffer, uint8_t size, long value, uint8_t decimals) {
+	if (decimals > NUMBER_MAX_DECIMALS) {
+		decimals = NUMBER_MAX_DECIMALS;
+	}
+
+	uint8_t length = 0;
+	unsigned long magnitude = value;
+	if (value < 0) {
+		if (!size) {
+			return 0;
+		}
+		buffer[length++] = '-';
+		magnitude = 0UL - magnitude;
+	}
+
+	unsigned long scale = POWERS_OF_TEN[decimals];
+	uint8_t written = format_digits(buffer + length, size - length, magnitude / scale, 1);
+	if (!written) {
+		return 0;
+	}
+	length += written;
+
+	if (decimals) {
+		if (length == size) {
+			return 0;
+		}
+		buffer[length++] = '.';
+		written = format_digits(buffer + length, size - length, magnitude % scale, decimals);
+		if (!written) {
+			return 0;
+		}
+		length += written;
+	}
+	return length;
+}
+
+size_t print_fixed(Print &out, long value, uint8_t decimals) {
+	char text[NUMBER_TEXT_MAX];
+	uint8_t length = format_fixed(text, sizeof(text), value, decimals);
+	return out.write((const uint8_t *) text, length);
+}
+
+uint32_t parse_number(const StrView &text, unsigned long &value) {
+	unsigned long number = 0;
+	uint32_t i = 0;
+	for (; i < text.length() && text[i] >= '0' && text[i] <= '9'; ++i) {
+		uint8_t digit = text[i] - '0';
+		if (number > (ULONG_MAX - digit) / 10) {
+			return 0;
+		}
+		number = number * 10 + digit;
+	}
+
+	if (i) {
+		value = number;
+	}
+	return i;
+}
+
+uint32_t parse_number(const StrView &text, long &value) {
+	bool negative = !text.empty() && text[0] == '-';
+	unsigned long magnitude;
+	uint32_t used = parse_number(text.substr(negative), magnitude);
+	unsigned long limit = negative ? (unsigned long) LONG_MAX + 1 : (unsigned long) LONG_MAX;
+	if (!used || magnitude > limit) {
+		return 0;
+	}
+
+	// Negated in two steps, the magnitude of LONG_MIN doesn't fit a long
+	value = negative && magnitude ? -(long) (magnitude - 1) - 1 : (long) magnitude;
+	return negative + used;
+}
+
+uint32_t parse_fixed(const StrView &text, uint8_t decimals, long &value) {
+	if (decimals > NUMBER_MAX_DECIMALS) {
+		decimals = NUMBER_MAX_DECIMALS;
+	}
+
+	bool negative = !text.empty() && text[0] == '-';
+	uint32_t i = negative;
+	unsigned long whole;
+	uint32_t used = parse_number(text.substr(i), whole);
+	if (!used) {
+		return 0;
+	}
+	i += used;
+
+	unsigned long fraction = 0;
+	uint8_t digits = 0;
+	if (i < text.length() && text[i] == '.') {
+		for (++i; i < text.length() && text[i] >= '0' && text[i] <= '9'; ++i) {
+			if (digits < decimals) {
+				fraction = fraction * 10 + (text[i] - '0');
+				digits++;
+			}
+		}
+	}
+	for (; digits < decimals; ++digits) {
+		fraction *= 10;
+	}
+
+	unsigned long scale = POWERS_OF_TEN[decimals];
+	unsigned long limit = negative ? (unsigned long) LONG_MAX + 1 : (unsigned long) LONG_MAX;
+	if (whole > (limit - fraction) / scale) {
+		return 0;
+	}
+
+	unsigned long magnitude = whole * scale + fraction;
+	// Negated in two steps, the magnitude of LONG_MIN doesn't fit a long
+	value = negative && magnitude ? -(long) (magnitude - 1) - 1 : (long) magnitude;
+	return i;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <Stream.h>
+#include "str_view.h"
+
+// Decimal numbers without printf, float or the heap. Besides plain
+// integers these handle fixed point values, integers scaled by
+// 10^decimals: 2157 with 2 decimals is "21.57".
+//
+// Formatting writes no more than size bytes and no terminator, and returns
+// the length of the text, 0 if it doesn't fit. Parsing reads a number at
+// the start of text and returns how many characters it took, 0 if there is
+// no number there or it doesn't fit the type.
+
+// Room for the longest text of a long or unsigned long, with its sign and
+// decimal point
+#define NUMBER_TEXT_MAX (sizeof(unsigned long) * 3 + 2)
+
+// Most decimals of a fixed point value, more are cut off
+#define NUMBER_MAX_DECIMALS 9
+
+uint8_t format_number(char *buffer, uint8_t size, unsigned long value);
+uint8_t format_number(char *buffer, uint8_t size, long value);
+
+inline uint8_t format_number(char *buffer, uint8_t size, unsigned int value) {
+	return format_number(buffer, size, (unsigned long) value);
+}
+
+inline uint8_t format_number(char *buffer, uint8_t size, int value) {
+	return format_number(buffer, size, (long) value);
+}
+
+uint8_t format_fixed(char *buffer, uint8_t size, long value, uint8_t decimals);
+
+// Print handles integers by itself, but would go through float for these
+size_t print_fixed(Print &out, long value, uint8_t decimals);
+
+uint32_t parse_number(const StrView &text, unsigned long &value);
+// Takes a leading '-'
+uint32_t parse_number(const StrView &text, long &value);
+// Takes a leading '-' and decimals after a '.', any beyond decimals are
+// skipped
+uint32_t parse_fixed(const StrView &text, uint8_t decimals, long &value);
+
+// The text of a number, kept on the stack for passing it on as a StrView.
+// A temporary one is gone at the end of the statement, so views of it
+// must not be kept:
+//
+//   barf.send_command(COMMAND_LED_MODE, NumberText(mode));
+class NumberText {
+public:
+	NumberText(unsigned long value) { length = format_number(text, sizeof(text), value); }
+	NumberText(long value) { length = format_number(text, sizeof(text), value); }
+	NumberText(unsigned int value) { length = format_number(text, sizeof(text), value); }
+	NumberText(int value) { length = format_number(text, sizeof(text), value); }
+	NumberText(long value, uint8_t decimals) { length = format_fixed(text, sizeof(text), value, decimals); }
+
+	operator StrView() const { return StrView(text, length); }
+
+private:
+	char text[NUMBER_TEXT_MAX];
+	uint8_t length;
+};
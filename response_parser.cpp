@@ -0,0 +1,146 @@
+#include "response_parser.h"
+#include "number.h"
+
+// Whether line starts with prefix, ignoring case
+static bool starts_with(const StrView &line, const char *prefix) {
+	uint32_t length = strlen(prefix);
+	if (line.length() < length) {
+		return false;
+	}
+	for (uint32_t i = 0; i < length; ++i) {
+		char c = line[i];
+		if (c >= 'A' && c <= 'Z') {
+			c += 'a' - 'A';
+		}
+		if (c != prefix[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static int32_t parse_count(const StrView &text) {
+	// Skips leading spaces, -1 if there is no number or it is too large
+	uint32_t i = 0;
+	while (i < text.length() && text[i] == ' ') {
+		i++;
+	}
+
+	unsigned long number;
+	return parse_number(text.substr(i), number) && number <= 0x7fffffffUL ? number : -1;
+}
+
+static int8_t hex_digit(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+ResponseParser::ResponseParser() {
+	response.status = 0;
+	response.content_length = -1;
+	response.chunked = false;
+	response.truncated = false;
+	state = HEAD;
+	remaining = 0;
+}
+
+void ResponseParser::head_line(StrView line) {
+	if (state != HEAD) {
+		return;
+	}
+	if (!line.empty() && line[line.length() - 1] == '\r') {
+		line = line.substr(0, line.length() - 1);
+	}
+
+	if (line.empty()) {
+		// Responses the firmware can delimit have a length or are chunked,
+		// anything else is taken to have no body
+		if (response.chunked) {
+			state = CHUNK_SIZE;
+		} else if (response.content_length > 0) {
+			state = BODY;
+			remaining = response.content_length;
+		} else {
+			state = DONE;
+		}
+	} else if (starts_with(line, "http/")) {
+		int space = line.find(' ');
+		if (space >= 0) {
+			int32_t status = parse_count(line.substr(space + 1));
+			response.status = status >= 0 && status <= 999 ? status : 0;
+		}
+	} else if (starts_with(line, "content-length:")) {
+		response.content_length = parse_count(line.substr(15));
+	} else if (starts_with(line, "transfer-encoding:")) {
+		StrView value = line.substr(18);
+		for (uint32_t i = 0; i < value.length(); ++i) {
+			if (starts_with(value.substr(i), "chunked")) {
+				response.chunked = true;
+			}
+		}
+	}
+}
+
+uint32_t ResponseParser::feed(const char *data, uint32_t length, BodySink sink, void *context) {
+	uint32_t used = 0;
+
+	while (used < length && state != DONE) {
+		char c = data[used];
+
+		switch (state) {
+			case BODY:
+			case CHUNK_DATA: {
+				uint32_t piece = length - used < remaining ? length - used : remaining;
+				sink(data + used, piece, context);
+				used += piece;
+				remaining -= piece;
+				if (!remaining) {
+					state = state == BODY ? DONE : CHUNK_END;
+				}
+				continue;
+			}
+			case CHUNK_SIZE: {
+				int8_t digit = hex_digit(c);
+				if (digit >= 0) {
+					remaining = remaining * 16 + digit;
+				} else if (c == '\n') {
+					state = remaining ? CHUNK_DATA : TRAILER;
+				} else {
+					state = CHUNK_EXTENSION;
+				}
+				break;
+			}
+			case CHUNK_EXTENSION:
+				if (c == '\n') {
+					state = remaining ? CHUNK_DATA : TRAILER;
+				}
+				break;
+			case CHUNK_END:
+				if (c == '\n') {
+					state = CHUNK_SIZE;
+				}
+				break;
+			case TRAILER:
+				// Trailer lines up to an empty one end the last chunk
+				if (c == '\n') {
+					state = remaining ? TRAILER : DONE;
+					remaining = 0;
+				} else if (c != '\r') {
+					remaining++;
+				}
+				break;
+			default:
+				break;
+		}
+		used++;
+	}
+	return used;
+}
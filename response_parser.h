@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include "str_view.h"
+
+// Receives a get/post response body piece by piece as it arrives
+typedef void (*BodySink)(const char *data, uint32_t length, void *context);
+
+// What the head of a get/post response said about it
+struct ResponseInfo {
+	// Status code, 0 if no valid status line arrived
+	int16_t status;
+	// Value of Content-Length, -1 if there was none
+	int32_t content_length;
+	bool chunked;
+	// Set by the get/post versions that store the body if it didn't fit
+	bool truncated;
+};
+
+// Follows a get/post response as the firmware passes it on: the head line
+// by line, then the raw body. The end of the body is found from its
+// Content-Length or its chunked encoding, which is decoded on the way.
+class ResponseParser {
+public:
+	ResponseParser();
+
+	// Takes one line of the head, the empty line ends it
+	void head_line(StrView line);
+	bool head_finished() const { return state != HEAD; }
+
+	// Passes the body in data on to sink and returns how many bytes were
+	// used, which is less than length only if the body ended before
+	uint32_t feed(const char *data, uint32_t length, BodySink sink, void *context);
+	bool finished() const { return state == DONE; }
+
+	const ResponseInfo &info() const { return response; }
+
+private:
+	enum State {
+		HEAD,
+		BODY,
+		CHUNK_SIZE,
+		// Rest of a chunk size line after the digits
+		CHUNK_EXTENSION,
+		CHUNK_DATA,
+		// Line break after a chunk's data
+		CHUNK_END,
+		TRAILER,
+		DONE
+	};
+
+	ResponseInfo response;
+	State state;
+	// Body or chunk bytes still to come, or characters on the current
+	// trailer line
+	uint32_t remaining;
+};
@@ -0,0 +1,104 @@
+#include <Arduino.h>
+#include "barf.h"
+#include "response_writer.h"
+
+ResponseWriter::ResponseWriter(Barf &barf) : barf(barf) {
+	started = false;
+	ended = false;
+	buffered = 0;
+}
+
+ResponseWriter::~ResponseWriter() {
+	end();
+}
+
+void ResponseWriter::begin(int status, const char *headers) {
+	barf.send_message(FRAME_OP_REPLY_BEGIN, NumberText(status));
+	started = true;
+
+	while (headers && *headers) {
+		const char *end = strchr(headers, '\n');
+		uint32_t length = end ? end - headers : strlen(headers);
+		StrView header(headers, length > 0 && headers[length - 1] == '\r' ? length - 1 : length);
+		if (!header.empty()) {
+			barf.send_message(FRAME_OP_REPLY_HEADER, header);
+		}
+		headers = end ? end + 1 : nullptr;
+	}
+}
+
+size_t ResponseWriter::write(uint8_t c) {
+	if (ended) {
+		return 0;
+	}
+	if (!started) {
+		begin(200);
+	}
+	if (buffered == BARF_REPLY_BUFFER_SIZE) {
+		flush_buffer();
+	}
+	buffer[buffered++] = c;
+	return 1;
+}
+
+size_t ResponseWriter::write(const uint8_t *data, size_t length) {
+	if (length < BARF_REPLY_BUFFER_SIZE) {
+		for (size_t i = 0; i < length; ++i) {
+			if (!write(data[i])) {
+				return i;
+			}
+		}
+		return length;
+	}
+
+	// Large writes are sent straight from where they are
+	if (ended) {
+		return 0;
+	}
+	if (!started) {
+		begin(200);
+	}
+	flush_buffer();
+	for (size_t offset = 0; offset < length; offset += REPLY_CHUNK_MAX) {
+		size_t chunk = length - offset < REPLY_CHUNK_MAX ? length - offset : REPLY_CHUNK_MAX;
+		barf.send_reply_chunk(data + offset, chunk);
+	}
+	return length;
+}
+
+size_t ResponseWriter::write_P(const char *data, size_t length) {
+	// Sent straight from flash, after what is already buffered
+	if (ended) {
+		return 0;
+	}
+	if (!started) {
+		begin(200);
+	}
+	flush_buffer();
+	for (size_t offset = 0; offset < length; offset += REPLY_CHUNK_MAX) {
+		size_t chunk = length - offset < REPLY_CHUNK_MAX ? length - offset : REPLY_CHUNK_MAX;
+		barf.send_reply_chunk_P(data + offset, chunk);
+	}
+	return length;
+}
+
+void ResponseWriter::flush_buffer() {
+	if (buffered) {
+		barf.send_reply_chunk(buffer, buffered);
+		buffered = 0;
+	}
+}
+
+void ResponseWriter::end() {
+	if (ended) {
+		return;
+	}
+	if (!started) {
+		// The client gets an empty reply rather than none
+		begin(200);
+	}
+	flush_buffer();
+	barf.send_message(FRAME_OP_REPLY_END, StrView());
+	started = false;
+	ended = true;
+}
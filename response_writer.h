@@ -0,0 +1,47 @@
+#pragma once
+
+#include <Stream.h>
+#include "config.h"
+
+class Barf;
+
+// Streams the reply to a served request in chunks, so bodies can be larger
+// than memory and contain any bytes. Everything written through Print ends
+// up in a small buffer that is sent as a chunk whenever it fills up.
+//
+//   ResponseWriter response(barf);
+//   response.begin(200, "Content-Type: text/html");
+//   response.print(F("<html>..."));
+//   response.end();
+class ResponseWriter : public Print {
+public:
+	explicit ResponseWriter(Barf &barf);
+	// Ends the reply if that hasn't happened yet, one that was never begun
+	// is sent as an empty 200 reply
+	~ResponseWriter();
+
+	// Starts the reply, writing without calling this first starts a 200
+	// reply without extra headers. headers are "Name: value" lines separated by
+	// newlines, Content-Length and Transfer-Encoding are taken care of.
+	void begin(int status, const char *headers = nullptr);
+
+	size_t write(uint8_t c);
+	size_t write(const uint8_t *data, size_t length);
+	using Print::write;
+
+	// Writes length bytes from flash
+	size_t write_P(const char *data, size_t length);
+
+	// Sends what is left in the buffer and completes the reply. Nothing can
+	// be written after this.
+	void end();
+
+private:
+	void flush_buffer();
+
+	Barf &barf;
+	bool started;
+	bool ended;
+	uint8_t buffer[BARF_REPLY_BUFFER_SIZE];
+	uint16_t buffered;
+};
@@ -0,0 +1,119 @@
+#include "barf.h"
+#include "router.h"
+
+Router::Router() {
+	node_count = 0;
+	first_method = NONE;
+}
+
+uint8_t Router::child(uint8_t &first, const StrView &segment) {
+	// Finds or adds the node for segment in the sibling list starting at first
+	for (uint8_t node = first; node != NONE; node = nodes[node].next_sibling) {
+		if (nodes[node].segment == segment) {
+			return node;
+		}
+	}
+
+	if (node_count == BARF_MAX_ROUTE_NODES) {
+		return NONE;
+	}
+
+	uint8_t node = node_count++;
+	nodes[node].segment = segment;
+	nodes[node].first_child = NONE;
+	nodes[node].handler = nullptr;
+
+	// Parameters go last so that literal siblings are tried first
+	uint8_t *link = &first;
+	if (segment[0] != ':') {
+		nodes[node].next_sibling = first;
+		first = node;
+		return node;
+	}
+	while (*link != NONE) {
+		link = &nodes[*link].next_sibling;
+	}
+	nodes[node].next_sibling = NONE;
+	*link = node;
+	return node;
+}
+
+bool Router::add(const char *method, const char *pattern, RouteHandler handler) {
+	uint8_t node = child(first_method, StrView(method));
+	StrView path(pattern);
+
+	while (node != NONE && !path.empty()) {
+		int slash = path.find('/');
+		StrView segment = slash == -1 ? path : path.substr(0, slash);
+		path = slash == -1 ? StrView() : path.substr(slash + 1);
+
+		if (!segment.empty()) {
+			node = child(nodes[node].first_child, segment);
+		}
+	}
+
+	if (node == NONE) {
+		return false;
+	}
+
+	nodes[node].handler = handler;
+	return true;
+}
+
+RouteHandler Router::match_node(uint8_t node, const CompactRequest &request, uint8_t depth, RouteParams &params) const {
+	if (depth == request.fragment_count()) {
+		return nodes[node].handler;
+	}
+
+	StrView fragment = request.fragment(depth);
+	for (uint8_t next = nodes[node].first_child; next != NONE; next = nodes[next].next_sibling) {
+		const StrView &segment = nodes[next].segment;
+		bool is_param = segment[0] == ':';
+
+		if (!is_param && segment != fragment) {
+			continue;
+		}
+		if (is_param && params.count == BARF_MAX_ROUTE_PARAMS) {
+			continue;
+		}
+
+		if (is_param) {
+			params.names[params.count] = segment.substr(1);
+			params.fragments[params.count] = depth;
+			params.count++;
+		}
+
+		RouteHandler handler = match_node(next, request, depth + 1, params);
+		if (handler) {
+			return handler;
+		}
+
+		if (is_param) {
+			params.count--;
+		}
+	}
+	return nullptr;
+}
+
+RouteHandler Router::match(const CompactRequest &request, RouteParams &params) const {
+	params.count = 0;
+
+	StrView method = request.method();
+	for (uint8_t node = first_method; node != NONE; node = nodes[node].next_sibling) {
+		if (nodes[node].segment != method && nodes[node].segment != "*") {
+			continue;
+		}
+
+		RouteHandler handler = match_node(node, request, 0, params);
+		if (handler) {
+			return handler;
+		}
+	}
+	return nullptr;
+}
+
+void RouteParams::bind(const Request &request) {
+	for (uint8_t i = 0; i < count; ++i) {
+		values[i] = &request.fragments[fragments[i]];
+	}
+}
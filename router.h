@@ -0,0 +1,66 @@
+#pragma once
+
+#include "config.h"
+#include "str_view.h"
+
+class Barf;
+class CompactRequest;
+struct Request;
+
+// Path parameters captured by a route. Names point into the route pattern
+// and values into the request's fragments, so nothing is copied.
+struct RouteParams {
+	uint8_t count;
+	StrView names[BARF_MAX_ROUTE_PARAMS];
+	const jsonic::containers::String *values[BARF_MAX_ROUTE_PARAMS];
+	// Fragment each value was captured from, values are set by bind()
+	uint8_t fragments[BARF_MAX_ROUTE_PARAMS];
+
+	// Points the values into request, built from the one that was matched
+	void bind(const Request &request);
+
+	// Value captured for :name, nullptr if the route has no such parameter
+	const jsonic::containers::String *get(const StrView &name) const {
+		for (uint8_t i = 0; i < count; ++i) {
+			if (names[i] == name) {
+				return values[i];
+			}
+		}
+		return nullptr;
+	}
+};
+
+typedef void (*RouteHandler)(Barf &barf, Request &request, const RouteParams &params);
+
+// Trie of routes over the method and path fragments, stored in a fixed
+// node pool. Patterns are kept as views, so they have to be string
+// literals or otherwise outlive the router.
+class Router {
+public:
+	Router();
+
+	// Registers handler for method ("GET", "POST" or "*" for any) and a
+	// pattern like "/sensor/:id". Returns false if the table is full.
+	bool add(const char *method, const char *pattern, RouteHandler handler);
+
+	// Finds the handler for request, literal segments win over parameters.
+	// Works on the queued request so only a matched one has to be built.
+	RouteHandler match(const CompactRequest &request, RouteParams &params) const;
+
+private:
+	static const uint8_t NONE = 0xff;
+
+	struct Node {
+		StrView segment;
+		uint8_t first_child;
+		uint8_t next_sibling;
+		RouteHandler handler;
+	};
+
+	uint8_t child(uint8_t &first, const StrView &segment);
+	RouteHandler match_node(uint8_t node, const CompactRequest &request, uint8_t depth, RouteParams &params) const;
+
+	Node nodes[BARF_MAX_ROUTE_NODES];
+	uint8_t node_count;
+	uint8_t first_method;
+};
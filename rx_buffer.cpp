@@ -0,0 +1,204 @@
+#include "rx_buffer.h"
+
+RxBuffer::RxBuffer() {
+	clear();
+}
+
+void RxBuffer::clear() {
+	head = 0;
+	count = 0;
+	scanned = 0;
+	skip_remaining = 0;
+	lost = false;
+}
+
+uint16_t RxBuffer::fill(Stream &ser) {
+	uint16_t read = 0;
+
+	while (count < BARF_RX_BUFFER_SIZE && ser.available()) {
+		uint16_t tail = head + count;
+		if (tail >= BARF_RX_BUFFER_SIZE) {
+			tail -= BARF_RX_BUFFER_SIZE;
+		}
+
+		buffer[tail] = ser.read();
+		count++;
+		read++;
+	}
+
+	return read;
+}
+
+bool RxBuffer::take_line(StrView &line, bool &complete) {
+	uint16_t index = head + scanned;
+	if (index >= BARF_RX_BUFFER_SIZE) {
+		index -= BARF_RX_BUFFER_SIZE;
+	}
+
+	while (scanned < count && buffer[index] != '\n') {
+		scanned++;
+		index++;
+		if (index == BARF_RX_BUFFER_SIZE) {
+			index = 0;
+		}
+	}
+
+	uint16_t length = scanned;
+	uint16_t taken;
+
+	if (scanned < count) {
+		// Found a newline, which is dropped from the line
+		complete = true;
+		taken = length + 1;
+	} else if (count == BARF_RX_BUFFER_SIZE) {
+		// Full without a newline, hand out what we have as a piece
+		complete = false;
+		taken = length;
+	} else {
+		return false;
+	}
+
+	if (head + length > BARF_RX_BUFFER_SIZE) {
+		make_contiguous();
+	}
+
+	line = StrView(buffer + head, length);
+	drop(taken);
+
+	return true;
+}
+
+bool RxBuffer::take_frame(uint8_t &opcode, StrView &payload, bool &complete) {
+	while (true) {
+		if (skip_remaining) {
+			uint16_t length = skip_remaining < count ? skip_remaining : count;
+			if (!length) {
+				return false;
+			}
+			drop(length);
+			skip_remaining -= length;
+			continue;
+		}
+
+		if (count < FRAME_HEADER_SIZE) {
+			return false;
+		}
+
+		uint8_t header[FRAME_HEADER_SIZE];
+		for (uint16_t i = 0; i < FRAME_HEADER_SIZE; ++i) {
+			header[i] = at(i);
+		}
+		uint16_t length = frame_read_length(header);
+
+		if (!frame_opcode_known(header[0])) {
+			// Not a frame header. Skip a byte and hope to find one further on.
+			drop(1);
+			lost = true;
+			continue;
+		}
+
+		if (length > BARF_RX_BUFFER_SIZE - FRAME_HEADER_SIZE) {
+			// Too long to ever fit, from a sender that doesn't split
+			// values. The payload is skipped whole rather than searched
+			// for frame headers.
+			skip_remaining = FRAME_HEADER_SIZE + length;
+			lost = true;
+			continue;
+		}
+
+		if (count < FRAME_HEADER_SIZE + length) {
+			return false;
+		}
+
+		if (head + FRAME_HEADER_SIZE + length > BARF_RX_BUFFER_SIZE) {
+			make_contiguous();
+		}
+
+		opcode = header[0];
+		complete = !frame_has_more(header);
+		payload = StrView(buffer + head + FRAME_HEADER_SIZE, length);
+		drop(FRAME_HEADER_SIZE + length);
+		return true;
+	}
+}
+
+bool RxBuffer::take_lost() {
+	bool was_lost = lost;
+	lost = false;
+	return was_lost;
+}
+
+int RxBuffer::peek() const {
+	return count ? at(0) : -1;
+}
+
+bool RxBuffer::starts_with(const StrView &prefix) const {
+	if (count < prefix.length()) {
+		return false;
+	}
+	for (uint16_t i = 0; i < prefix.length(); ++i) {
+		if (at(i) != (uint8_t) prefix[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+StrView RxBuffer::peek_bytes() const {
+	uint16_t length = head + count > BARF_RX_BUFFER_SIZE ? BARF_RX_BUFFER_SIZE - head : count;
+	return StrView(buffer + head, length);
+}
+
+bool RxBuffer::peek_frame_header(uint8_t &opcode, uint16_t &length) const {
+	if (count < FRAME_HEADER_SIZE) {
+		return false;
+	}
+
+	uint8_t header[FRAME_HEADER_SIZE];
+	for (uint16_t i = 0; i < FRAME_HEADER_SIZE; ++i) {
+		header[i] = at(i);
+	}
+	opcode = header[0];
+	length = frame_read_length(header);
+	return true;
+}
+
+uint8_t RxBuffer::at(uint16_t offset) const {
+	uint16_t index = head + offset;
+	if (index >= BARF_RX_BUFFER_SIZE) {
+		index -= BARF_RX_BUFFER_SIZE;
+	}
+	return buffer[index];
+}
+
+void RxBuffer::drop(uint16_t length) {
+	head += length;
+	if (head >= BARF_RX_BUFFER_SIZE) {
+		head -= BARF_RX_BUFFER_SIZE;
+	}
+	count -= length;
+	scanned = 0;
+
+	if (count == 0) {
+		// Restarting at the front keeps lines from wrapping around
+		head = 0;
+	}
+}
+
+void RxBuffer::make_contiguous() {
+	// Rotate the buffer in place so that head ends up at index 0
+	reverse(0, head);
+	reverse(head, BARF_RX_BUFFER_SIZE);
+	reverse(0, BARF_RX_BUFFER_SIZE);
+	head = 0;
+}
+
+void RxBuffer::reverse(uint16_t from, uint16_t to) {
+	while (from + 1 < to) {
+		to--;
+		char c = buffer[from];
+		buffer[from] = buffer[to];
+		buffer[to] = c;
+		from++;
+	}
+}
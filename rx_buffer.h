@@ -0,0 +1,65 @@
+#pragma once
+
+#include <Stream.h>
+#include "config.h"
+#include "constants.h"
+#include "str_view.h"
+
+// Fixed-capacity receive ring buffer with line framing on top. Lines are
+// handed out as views into the buffer, so nothing is copied or allocated
+// per byte.
+class RxBuffer {
+public:
+	RxBuffer();
+
+	// Moves the bytes the stream has available into the buffer, returns
+	// how many were read
+	uint16_t fill(Stream &ser);
+
+	// Takes the next line out of the buffer, without the trailing newline.
+	// If the buffer fills up without a newline, its whole content is
+	// returned as a piece of the line and complete is set to false.
+	// The view is valid until the next call to fill() or take_line().
+	bool take_line(StrView &line, bool &complete);
+
+	// Takes the next binary frame out of the buffer once all of it has
+	// arrived. The payload view has the same lifetime as a line. complete
+	// is false if the payload goes on in a CONTINUATION frame.
+	bool take_frame(uint8_t &opcode, StrView &payload, bool &complete);
+	// Whether bytes that weren't valid frames were skipped since the last
+	// call
+	bool take_lost();
+
+	// First byte in the buffer, -1 if it is empty
+	int peek() const;
+	// Whether the buffer begins with prefix, false until all of it is there
+	bool starts_with(const StrView &prefix) const;
+
+	// The bytes at the front of the buffer, as far as they are contiguous,
+	// for data that isn't split into lines or frames. Valid until the next
+	// call to fill() or drop().
+	StrView peek_bytes() const;
+	void drop(uint16_t length);
+
+	// Header of the frame at the front of the buffer, for frames whose
+	// payload is taken out with peek_bytes() rather than all at once
+	bool peek_frame_header(uint8_t &opcode, uint16_t &length) const;
+
+	void clear();
+	uint16_t size() const { return count; }
+	uint16_t free_space() const { return BARF_RX_BUFFER_SIZE - count; }
+
+private:
+	uint8_t at(uint16_t offset) const;
+	void make_contiguous();
+	void reverse(uint16_t from, uint16_t to);
+
+	char buffer[BARF_RX_BUFFER_SIZE];
+	uint16_t head;
+	uint16_t count;
+	// Number of bytes after head already known not to contain a newline
+	uint16_t scanned;
+	// Bytes of an over-long frame still to be skipped
+	uint16_t skip_remaining;
+	bool lost;
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include "config.h"
+
+// Statements that only keep statistics, compiled out without BARF_STATS
+#if BARF_STATS
+#define BARF_STAT(statement) statement
+#else
+#define BARF_STAT(statement)
+#endif
+
+// Request parse times are counted in buckets: bucket i holds requests that
+// took less than 32 << i us to parse, the last one everything slower
+#define BARF_PARSE_TIME_BUCKETS 8
+
+// Counters of what the library has been doing, see Barf::stats() and
+// debug_info()
+struct BarfStats {
+	uint32_t requests;
+	// Requests that arrived while the request queue was full
+	uint32_t requests_dropped;
+	uint16_t parse_time[BARF_PARSE_TIME_BUCKETS];
+	uint8_t queue_depth;
+	uint8_t queue_depth_max;
+
+	uint32_t read_timeouts;
+	uint32_t unexpected_commands;
+	uint32_t bytes_in;
+	uint32_t bytes_out;
+
+	// Completed get/post requests, synchronous or not, with their total
+	// and longest round trip in ms
+	uint32_t round_trips;
+	uint32_t round_trip_total;
+	uint32_t round_trip_max;
+	uint32_t response_timeouts;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string.h>
+#include "alloc.h"
+#include "jsonic/containers.h"
+
+// Non-owning view of a run of characters, usually a line inside the receive
+// buffer. The view is only valid for as long as the memory it points to.
+class StrView {
+public:
+	StrView() : data_(""), length_(0) {}
+	StrView(const char *data, uint32_t length) : data_(data), length_(length) {}
+	StrView(const char *cstr) : data_(cstr), length_(strlen(cstr)) {}
+	StrView(const jsonic::containers::String &s) : data_(s.c_str()), length_(s.length()) {}
+
+	const char *data() const { return data_; }
+	uint32_t length() const { return length_; }
+	bool empty() const { return length_ == 0; }
+
+	char operator[](uint32_t index) const {
+		return data_[index];
+	}
+
+	int find(char c, uint32_t pos = 0) const {
+		for (uint32_t i = pos; i < length_; ++i) {
+			if (data_[i] == c) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	StrView substr(uint32_t pos, uint32_t len) const {
+		if (pos > length_) {
+			pos = length_;
+		}
+		if (len > length_ - pos) {
+			len = length_ - pos;
+		}
+		return StrView(data_ + pos, len);
+	}
+
+	StrView substr(uint32_t pos) const {
+		return substr(pos, length_);
+	}
+
+	bool operator==(const StrView &rhs) const {
+		return length_ == rhs.length_ && memcmp(data_, rhs.data_, length_) == 0;
+	}
+
+	bool operator!=(const StrView &rhs) const {
+		return !(*this == rhs);
+	}
+
+	jsonic::containers::String to_string() const {
+		return jsonic::containers::String(data_, length_);
+	}
+
+private:
+	const char *data_;
+	uint32_t length_;
+};
+
+// Splits "command value" at the first space without copying anything
+inline void split_command(const StrView &line, StrView &command, StrView &value) {
+	int space_index = line.find(' ');
+
+	if (space_index != -1) {
+		command = line.substr(0, space_index);
+		value = line.substr(space_index + 1);
+	} else {
+		command = line;
+		value = StrView();
+	}
+}